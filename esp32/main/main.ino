@@ -46,14 +46,85 @@ IPAddress secondaryDNS(8, 8, 8, 8);
 WiFiUDP udp;
 #endif
 
+// Legacy fixed-size raw frame, still used over serial
 #define BUFFER_SIZE (RECEIVED_LEDS * 3)
+
+// Chunked frame protocol, see src/protocol.h on the host side
+#define PROTO_MAGIC 0xFF
+#define PROTO_CONFIG 0xAA
+#define PROTO_FRAME 0xBB
+#define PROTO_FRAME_HEADER_SIZE 12
+#define PROTO_FRAME_ID_WINDOW 32
+#define PROTO_ENCODING_RGB888 0
+#define PROTO_ENCODING_RGB565 1
+#define FRAME_FLAG_SCENE_CUT 0x01
+#define MAX_RECEIVED_LEDS 2048
+#define MAX_PACKET_SIZE 2048 // PROTO_MAX_PAYLOAD on the host
+
 #define TIMEOUT_MS 10000
 #define STARTUP_BLINK_DURATION 2000
+#define STATS_INTERVAL_MS 5000
+#define CONFIG_SIZE 12
+
+// Network runs on core 0 next to the WiFi stack, rendering stays on the
+// Arduino loop core so FastLED.show() never stalls packet reception.
+#define RX_TASK_CORE 0
+#define RX_TASK_PRIORITY 5
+#define RX_TASK_STACK 4096
 
 enum SystemState { STATE_WAITING_CONFIG, STATE_ACTIVE, STATE_TIMEOUT };
 
 CRGB leds[NUM_LEDS];
-uint8_t rxBuffer[BUFFER_SIZE];
+
+// Newest frame handed from the receive task to the render loop. Only the
+// latest one is kept: a frame that is overwritten before it was shown is
+// counted as dropped rather than displayed late.
+// Three slots rotate by pointer so no frame data is copied under the lock.
+struct FrameSlot {
+        uint8_t data[MAX_RECEIVED_LEDS * 3];
+        uint16_t ledCount;
+        uint8_t flags;
+        uint32_t rxMicros;
+};
+
+FrameSlot frameSlots[3];
+FrameSlot *writeSlot = &frameSlots[0];
+FrameSlot *pendingSlot = &frameSlots[1];
+FrameSlot *renderSlot = &frameSlots[2];
+bool pendingFrameReady = false;
+
+// Chunks are decoded straight into this buffer, which persists across
+// frames: if a chunk is lost its LEDs keep their previous colours while
+// the chunks that did arrive are still applied.
+struct FrameAssembly {
+        uint8_t data[MAX_RECEIVED_LEDS * 3];
+        uint16_t frameId;
+        uint16_t total;
+        uint16_t ledsReceived;
+        uint8_t flags;
+        bool active;
+        bool published;
+};
+
+FrameAssembly assembly;
+
+uint8_t pendingConfig[CONFIG_SIZE];
+size_t pendingConfigSize = 0;
+
+portMUX_TYPE frameMux = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t renderTask = NULL;
+
+struct FrameStats {
+        uint32_t received;
+        uint32_t shown;
+        uint32_t dropped;
+        uint32_t malformed;
+        uint32_t latencySumUs;
+        uint32_t latencyMaxUs;
+};
+
+FrameStats frameStats;
+unsigned long lastStatsTime = 0;
 
 uint8_t g_brightness = 150;
 float g_saturation = 1.0f;
@@ -126,8 +197,12 @@ void boost_saturation_f(float &r, float &g, float &b, float boost) {
         }
 }
 
+bool isConfigPacket(const uint8_t *buffer, size_t size) {
+        return size >= 4 && buffer[0] == PROTO_MAGIC && buffer[1] == PROTO_CONFIG;
+}
+
 bool processConfigPacket(uint8_t *buffer, size_t size) {
-        if (size >= 4 && buffer[0] == 0xFF && buffer[1] == 0xAA) {
+        if (isConfigPacket(buffer, size)) {
                 g_brightness = buffer[2];
                 FastLED.setBrightness(g_brightness);
                 
@@ -147,43 +222,185 @@ bool processConfigPacket(uint8_t *buffer, size_t size) {
         return false;
 }
 
-void waitForConfig() {
-        uint8_t configBuffer[12];
+void publishFrame(const uint8_t *rgb, uint16_t ledCount, uint8_t flags) {
+        memcpy(writeSlot->data, rgb, ledCount * 3);
+        writeSlot->ledCount = ledCount;
+        writeSlot->flags = flags;
+        writeSlot->rxMicros = micros();
+
+        portENTER_CRITICAL(&frameMux);
+        if (pendingFrameReady) {
+                // Keep the flags of the frame that is never shown, a dropped
+                // scene cut must still reset the smoothing on the next one
+                writeSlot->flags |= pendingSlot->flags;
+                frameStats.dropped++;
+        }
+        FrameSlot *tmp = pendingSlot;
+        pendingSlot = writeSlot;
+        writeSlot = tmp;
+        pendingFrameReady = true;
+        frameStats.received++;
+        portEXIT_CRITICAL(&frameMux);
+}
 
-        currentState = STATE_WAITING_CONFIG;
+void countMalformed() {
+        portENTER_CRITICAL(&frameMux);
+        frameStats.malformed++;
+        portEXIT_CRITICAL(&frameMux);
+}
 
-        while (true) {
-                bool hasData = false;
-                size_t bytesRead = 0;
+void publishAssembly() {
+        if (!assembly.published) {
+                publishFrame(assembly.data, assembly.total, assembly.flags);
+                assembly.published = true;
+        }
+}
 
-#ifdef SERIAL
-                if (Serial.available() >= 12) {
-                        bytesRead = Serial.readBytes(configBuffer, 12);
-                        hasData = (bytesRead == 12);
-                } else if (Serial.available() >= 4) {
-                        bytesRead = Serial.readBytes(configBuffer, 4);
-                        hasData = (bytesRead == 4);
+static uint16_t getU16(const uint8_t *src) { return src[0] | (src[1] << 8); }
+
+// Returns true if a frame was published
+bool processFrameChunk(const uint8_t *buffer, size_t size) {
+        if (size < PROTO_FRAME_HEADER_SIZE || buffer[0] != PROTO_MAGIC ||
+            buffer[1] != PROTO_FRAME) {
+                countMalformed();
+                return false;
+        }
+
+        uint8_t flags = buffer[2];
+        uint8_t encoding = buffer[3];
+        uint16_t frameId = getU16(buffer + 4);
+        uint16_t offset = getU16(buffer + 6);
+        uint16_t count = getU16(buffer + 8);
+        uint16_t total = getU16(buffer + 10);
+        size_t bytesPerLed = encoding == PROTO_ENCODING_RGB565 ? 2 : 3;
+
+        if ((encoding != PROTO_ENCODING_RGB888 && encoding != PROTO_ENCODING_RGB565) ||
+            total == 0 || total > MAX_RECEIVED_LEDS || offset + count > total ||
+            size < PROTO_FRAME_HEADER_SIZE + count * bytesPerLed) {
+                countMalformed();
+                return false;
+        }
+
+        bool published = false;
+
+        if (!assembly.active || frameId != assembly.frameId) {
+                // Late chunk of a frame we already moved past. Anything further
+                // back is a restarted sender whose ids began again at 0.
+                int16_t age = (int16_t)(frameId - assembly.frameId);
+                if (assembly.active && age < 0 && age >= -PROTO_FRAME_ID_WINDOW) {
+                        return false;
                 }
-#endif
+
+                // Show whatever arrived of the previous frame before starting the next
+                if (assembly.active && !assembly.published) {
+                        publishAssembly();
+                        published = true;
+                }
+
+                assembly.frameId = frameId;
+                assembly.total = total;
+                assembly.ledsReceived = 0;
+                assembly.flags = 0;
+                assembly.active = true;
+                assembly.published = false;
+        }
+
+        const uint8_t *payload = buffer + PROTO_FRAME_HEADER_SIZE;
+        uint8_t *dst = assembly.data + offset * 3;
+
+        if (encoding == PROTO_ENCODING_RGB565) {
+                for (uint16_t i = 0; i < count; i++) {
+                        uint16_t packed = getU16(payload + i * 2);
+                        uint8_t r = (packed >> 11) & 0x1F;
+                        uint8_t g = (packed >> 5) & 0x3F;
+                        uint8_t b = packed & 0x1F;
+                        dst[i * 3 + 0] = (r << 3) | (r >> 2);
+                        dst[i * 3 + 1] = (g << 2) | (g >> 4);
+                        dst[i * 3 + 2] = (b << 3) | (b >> 2);
+                }
+        } else {
+                memcpy(dst, payload, count * 3);
+        }
+
+        assembly.flags |= flags;
+        assembly.ledsReceived += count;
+
+        if (assembly.ledsReceived >= assembly.total && !assembly.published) {
+                publishAssembly();
+                published = true;
+        }
+
+        return published;
+}
+
+void publishConfig(const uint8_t *buffer, size_t size) {
+        portENTER_CRITICAL(&frameMux);
+        pendingConfigSize = min(size, (size_t)CONFIG_SIZE);
+        memcpy(pendingConfig, buffer, pendingConfigSize);
+        portEXIT_CRITICAL(&frameMux);
+}
+
+// Runs on RX_TASK_CORE. Drains everything queued in lwIP each wakeup so a
+// burst collapses into its newest frame instead of being replayed one per loop.
+void receiveTask(void *arg) {
+        static uint8_t rxBuffer[MAX_PACKET_SIZE];
+
+        while (true) {
+                bool gotPacket = false;
 
 #ifdef WIFI
-                int packetSize = udp.parsePacket();
-                if (packetSize >= 4) {
-                        bytesRead = udp.read(configBuffer, sizeof(configBuffer));
-                        hasData = (bytesRead >= 4);
+                int packetSize;
+                while ((packetSize = udp.parsePacket()) > 0) {
+                        if (packetSize > MAX_PACKET_SIZE) {
+                                countMalformed();
+                                continue;
+                        }
+
+                        size_t bytesRead = udp.read(rxBuffer, sizeof(rxBuffer));
+
+                        if (isConfigPacket(rxBuffer, bytesRead)) {
+                                // The host sends a config on startup, its frame ids restart
+                                assembly.active = false;
+                                publishConfig(rxBuffer, bytesRead);
+                                gotPacket = true;
+                        } else if (processFrameChunk(rxBuffer, bytesRead)) {
+                                gotPacket = true;
+                        }
                 }
 #endif
 
-                if (hasData) {
-                        if (processConfigPacket(configBuffer, bytesRead)) {
-                                currentState = STATE_ACTIVE;
-                                lastFrameTime = millis();
-                                return;
+#ifdef SERIAL
+                if (Serial.available() >= CONFIG_SIZE && Serial.available() < BUFFER_SIZE &&
+                    Serial.peek() == 0xFF) {
+                        size_t bytesRead = Serial.readBytes(rxBuffer, CONFIG_SIZE);
+                        if (isConfigPacket(rxBuffer, bytesRead)) {
+                                publishConfig(rxBuffer, bytesRead);
+                                gotPacket = true;
                         }
                 }
 
-                yield();
-                delay(10);
+                while (Serial.available() >= BUFFER_SIZE) {
+                        size_t bytesRead = Serial.readBytes(rxBuffer, BUFFER_SIZE);
+                        if (bytesRead != BUFFER_SIZE) {
+                                while (Serial.available())
+                                        Serial.read();
+                                break;
+                        }
+
+                        if (isConfigPacket(rxBuffer, bytesRead)) {
+                                publishConfig(rxBuffer, bytesRead);
+                        } else {
+                                publishFrame(rxBuffer, RECEIVED_LEDS, 0);
+                        }
+                        gotPacket = true;
+                }
+#endif
+
+                if (gotPacket && renderTask != NULL) {
+                        xTaskNotifyGive(renderTask);
+                } else {
+                        vTaskDelay(1);
+                }
         }
 }
 
@@ -192,14 +409,58 @@ void enterTimeoutState() {
                 FastLED.clear();
                 FastLED.show();
                 currentState = STATE_TIMEOUT;
+        }
+}
 
-#ifdef SERIAL
-                while (Serial.available())
-                        Serial.read();
-#endif
+void renderColors(const FrameSlot &frame) {
+        for (int i = 0; i < NUM_LEDS; i++) {
+                int srcIndex = (i * frame.ledCount) / NUM_LEDS;
+                srcIndex = constrain(srcIndex, 0, frame.ledCount - 1);
+                int offset = srcIndex * 3;
+
+                float target_r = frame.data[offset + 0] / 255.0f;
+                float target_g = frame.data[offset + 1] / 255.0f;
+                float target_b = frame.data[offset + 2] / 255.0f;
+
+                boost_saturation_f(target_r, target_g, target_b, g_saturation);
+
+                if (first_frame) {
+                        smoothed_colors[i].r = target_r;
+                        smoothed_colors[i].g = target_g;
+                        smoothed_colors[i].b = target_b;
+                } else {
+                        smoothed_colors[i].r = g_smoothing * target_r + (1.0f - g_smoothing) * smoothed_colors[i].r;
+                        smoothed_colors[i].g = g_smoothing * target_g + (1.0f - g_smoothing) * smoothed_colors[i].g;
+                        smoothed_colors[i].b = g_smoothing * target_b + (1.0f - g_smoothing) * smoothed_colors[i].b;
+                }
 
-                waitForConfig();
+                leds[i] = CRGB(
+                    (uint8_t)(smoothed_colors[i].r * 255.0f + 0.5f),
+                    (uint8_t)(smoothed_colors[i].g * 255.0f + 0.5f),
+                    (uint8_t)(smoothed_colors[i].b * 255.0f + 0.5f)
+                );
         }
+        first_frame = false;
+}
+
+void reportStats() {
+        if (millis() - lastStatsTime < STATS_INTERVAL_MS) {
+                return;
+        }
+        lastStatsTime = millis();
+
+        portENTER_CRITICAL(&frameMux);
+        FrameStats stats = frameStats;
+        memset(&frameStats, 0, sizeof(frameStats));
+        portEXIT_CRITICAL(&frameMux);
+
+        if (stats.received == 0) {
+                return;
+        }
+
+        Serial.printf("frames rx=%u shown=%u dropped=%u malformed=%u latency avg=%uus max=%uus\n",
+                      stats.received, stats.shown, stats.dropped, stats.malformed,
+                      stats.shown ? stats.latencySumUs / stats.shown : 0, stats.latencyMaxUs);
 }
 
 #ifdef WIFI
@@ -263,101 +524,80 @@ void setup() {
 
         startupBlink();
 
-        waitForConfig();
+        renderTask = xTaskGetCurrentTaskHandle();
+        xTaskCreatePinnedToCore(receiveTask, "udp_rx", RX_TASK_STACK, NULL, RX_TASK_PRIORITY,
+                                NULL, RX_TASK_CORE);
 }
 
 void loop() {
-        if (currentState == STATE_ACTIVE && millis() - lastFrameTime > TIMEOUT_MS) {
-                enterTimeoutState();
-                return;
+        // Woken by the receive task, the timeout only bounds how long the
+        // state machine below can go without running.
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+
+        uint8_t configBuffer[CONFIG_SIZE];
+        size_t configSize = 0;
+        bool frameReady = false;
+
+        portENTER_CRITICAL(&frameMux);
+        if (pendingConfigSize > 0) {
+                configSize = pendingConfigSize;
+                memcpy(configBuffer, pendingConfig, configSize);
+                pendingConfigSize = 0;
         }
+        if (pendingFrameReady) {
+                FrameSlot *tmp = renderSlot;
+                renderSlot = pendingSlot;
+                pendingSlot = tmp;
+                pendingFrameReady = false;
+                frameReady = true;
+        }
+        portEXIT_CRITICAL(&frameMux);
 
-        bool dataAvailable = false;
-        size_t bytesRead = 0;
+        // A frame that arrived together with the config is rendered below
+        if (configSize > 0 && processConfigPacket(configBuffer, configSize)) {
+                lastFrameTime = millis();
+                currentState = STATE_ACTIVE;
+        }
 
-#ifdef WIFI
-        int packetSize = udp.parsePacket();
-        if (packetSize >= BUFFER_SIZE) {
-                bytesRead = udp.read(rxBuffer, BUFFER_SIZE);
-                dataAvailable = (bytesRead == BUFFER_SIZE);
-        } else if (packetSize >= 4) {
-                uint8_t tempBuf[12];
-                bytesRead = udp.read(tempBuf, sizeof(tempBuf));
-                if (processConfigPacket(tempBuf, bytesRead)) {
-                        lastFrameTime = millis();
-                        if (currentState != STATE_ACTIVE) {
-                                currentState = STATE_ACTIVE;
-                        }
-                        return;
+        // Frames are only shown once a config packet has started a session
+        if (currentState != STATE_ACTIVE) {
+                if (frameReady) {
+                        portENTER_CRITICAL(&frameMux);
+                        frameStats.dropped++;
+                        portEXIT_CRITICAL(&frameMux);
                 }
-        } else if (packetSize > 0) {
-                udp.flush();
+                return;
         }
-#endif
-
-#ifdef SERIAL
-        if (Serial.available() >= BUFFER_SIZE) {
-                bytesRead = Serial.readBytes(rxBuffer, BUFFER_SIZE);
-                dataAvailable = (bytesRead == BUFFER_SIZE);
 
-                if (!dataAvailable) {
-                        while (Serial.available())
-                                Serial.read();
-                }
+        if (millis() - lastFrameTime > TIMEOUT_MS) {
+                enterTimeoutState();
+                return;
         }
-#endif
 
-        if (dataAvailable) {
-                if (processConfigPacket(rxBuffer, bytesRead)) {
-                        lastFrameTime = millis();
-                        if (currentState != STATE_ACTIVE) {
-                                currentState = STATE_ACTIVE;
-                        }
-#ifdef SERIAL
-                        while (Serial.available())
-                                Serial.read();
-#endif
-                        return;
+        if (frameReady) {
+                // Hard cut on the host: drop the smoothing history so the new
+                // scene is shown at once instead of being blended in.
+                if (renderSlot->flags & FRAME_FLAG_SCENE_CUT) {
+                        first_frame = true;
                 }
 
-                for (int i = 0; i < NUM_LEDS; i++) {
-                        int srcIndex = (i * RECEIVED_LEDS) / NUM_LEDS;
-                        srcIndex = constrain(srcIndex, 0, RECEIVED_LEDS - 1);
-                        int offset = srcIndex * 3;
-
-                        float target_r = rxBuffer[offset + 0] / 255.0f;
-                        float target_g = rxBuffer[offset + 1] / 255.0f;
-                        float target_b = rxBuffer[offset + 2] / 255.0f;
-
-                        boost_saturation_f(target_r, target_g, target_b, g_saturation);
-
-                        if (first_frame) {
-                                smoothed_colors[i].r = target_r;
-                                smoothed_colors[i].g = target_g;
-                                smoothed_colors[i].b = target_b;
-                        } else {
-                                smoothed_colors[i].r = g_smoothing * target_r + (1.0f - g_smoothing) * smoothed_colors[i].r;
-                                smoothed_colors[i].g = g_smoothing * target_g + (1.0f - g_smoothing) * smoothed_colors[i].g;
-                                smoothed_colors[i].b = g_smoothing * target_b + (1.0f - g_smoothing) * smoothed_colors[i].b;
-                        }
+                renderColors(*renderSlot);
+                FastLED.show();
 
-                        leds[i] = CRGB(
-                            (uint8_t)(smoothed_colors[i].r * 255.0f + 0.5f),
-                            (uint8_t)(smoothed_colors[i].g * 255.0f + 0.5f),
-                            (uint8_t)(smoothed_colors[i].b * 255.0f + 0.5f)
-                        );
+                uint32_t latencyUs = micros() - renderSlot->rxMicros;
+                portENTER_CRITICAL(&frameMux);
+                frameStats.shown++;
+                frameStats.latencySumUs += latencyUs;
+                if (latencyUs > frameStats.latencyMaxUs) {
+                        frameStats.latencyMaxUs = latencyUs;
                 }
-                first_frame = false;
+                portEXIT_CRITICAL(&frameMux);
 
-                FastLED.show();
                 lastFrameTime = millis();
-                currentState = STATE_ACTIVE;
-
-#ifdef SERIAL
-                while (Serial.available())
-                        Serial.read();
-#endif
         }
 
-        yield();
+#ifdef WIFI
+        // The serial build shares the port with the data stream
+        reportStats();
+#endif
 }
@@ -0,0 +1,37 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Virtual grid the screen is mapped onto. Each zone is CAPTURE_DEPTH x
+// CAPTURE_DEPTH grid cells along the left, top and right edges.
+#define CAPTURE_WIDTH 160
+#define CAPTURE_HEIGHT 90
+#define CAPTURE_DEPTH 10
+#define CAPTURE_FRAMES 24
+
+#define NUM_ZONES                                                                                  \
+        (((CAPTURE_HEIGHT - CAPTURE_DEPTH) / CAPTURE_DEPTH + 1) +                                  \
+         ((CAPTURE_WIDTH + CAPTURE_DEPTH - 1) / CAPTURE_DEPTH) +                                   \
+         ((CAPTURE_HEIGHT + CAPTURE_DEPTH - 1) / CAPTURE_DEPTH))
+
+// A 4 byte per pixel image the edge sampler reads from. The PipeWire path
+// passes the whole frame for every edge; region capture backends pass only
+// the strip, with origin_x/origin_y giving its top-left corner on screen.
+struct edge_source {
+        const uint8_t *data;
+        size_t size;
+        uint32_t stride;
+        int origin_x;
+        int origin_y;
+};
+
+// Called once per captured frame with the left, top and right edge images
+// of a width x height screen.
+typedef void (*capture_frame_fn)(const struct edge_source *left, const struct edge_source *top,
+                                 const struct edge_source *right, uint32_t width, uint32_t height,
+                                 bool is_bgr, uint64_t timestamp_ns);
+
+#endif
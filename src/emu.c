@@ -0,0 +1,763 @@
+// blight-emu: host-side stand-in for the ESP32 receiver.
+//
+// Listens on the firmware's UDP port and runs the same config handling, frame
+// reassembly, timeout state machine and LED resampling as esp32/main/main.ino,
+// so blight can be soak-tested without hardware. Packets can be dropped,
+// delayed, jittered and reordered on the way in to see how the stream copes.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "stats.h"
+
+// Firmware limits, keep in sync with esp32/main/main.ino
+#define NUM_LEDS 62
+#define MAX_RECEIVED_LEDS 2048
+#define MAX_PACKET_SIZE PROTO_MAX_PAYLOAD
+#define TIMEOUT_MS 10000
+#define UDP_PORT 4210
+
+// The firmware's render loop wakes at least this often to check the timeout
+#define STATE_POLL_MS 100
+// processConfigPacket() blocks the render loop for its green flash
+#define CONFIG_FLASH_MS 100
+// Packets held back for delay, jitter and reordering
+#define EMU_QUEUE_SIZE 1024
+// Extra hold time for a reordered packet on top of the configured delay
+#define REORDER_HOLD_NS 5000000ULL
+
+enum SystemState { STATE_WAITING_CONFIG, STATE_ACTIVE, STATE_TIMEOUT };
+
+struct pending_packet {
+        uint64_t due_ns;
+        uint64_t rx_ns;
+        size_t len;
+        uint8_t data[MAX_PACKET_SIZE];
+};
+
+struct FrameAssembly {
+        uint8_t data[MAX_RECEIVED_LEDS * 3];
+        uint16_t frameId;
+        uint16_t total;
+        uint16_t ledsReceived;
+        uint8_t flags;
+        uint64_t rx_ns;
+        bool active;
+        bool published;
+};
+
+struct ColorFloat {
+        float r, g, b;
+};
+
+// Counters are 64 bit so an hours-long soak never wraps
+struct emu_counters {
+        uint64_t packets;
+        uint64_t configs;
+        uint64_t frames;
+        uint64_t incomplete;
+        uint64_t missing_ids;
+        uint64_t late_chunks;
+        uint64_t dropped;
+        uint64_t malformed;
+        uint64_t injected_loss;
+        uint64_t injected_reorder;
+        uint64_t queue_overflow;
+        uint64_t timeouts;
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+static int g_loss_pct = 0;
+static int g_reorder_pct = 0;
+static uint64_t g_delay_ns = 0;
+static uint64_t g_jitter_ns = 0;
+static bool g_verbose = false;
+static FILE *g_csv = NULL;
+
+static struct pending_packet g_queue[EMU_QUEUE_SIZE];
+static size_t g_queue_len = 0;
+
+static struct FrameAssembly assembly;
+// Frame waiting for the render loop while it is blocked, like pendingSlot
+static struct FrameAssembly g_held;
+static bool g_held_ready = false;
+static uint64_t g_flash_until = 0;
+static bool g_have_last_id = false;
+static uint16_t g_last_id = 0;
+
+static uint8_t g_brightness = 150;
+static float g_saturation = 1.0f;
+static float g_smoothing = 1.0f;
+static uint8_t leds[NUM_LEDS * 3];
+static struct ColorFloat smoothed_colors[NUM_LEDS];
+static bool first_frame = true;
+
+static enum SystemState currentState = STATE_WAITING_CONFIG;
+static uint64_t lastFrameTime = 0;
+
+// Lifetime latency distribution for soaks far longer than a stats window.
+// Fixed 0.1 ms buckets, the last one collects everything above 2 s.
+#define HIST_BUCKET_NS 100000ULL
+#define HIST_BUCKETS 20000
+
+struct histogram {
+        uint64_t buckets[HIST_BUCKETS];
+        uint64_t count;
+        uint64_t max_ns;
+};
+
+// Time between shown frames and the one-way delay the emulator added
+struct timing {
+        struct latency_stats frame_gap;
+        struct latency_stats added_delay;
+        uint64_t max_gap_ns;
+};
+
+static uint64_t g_start_ns = 0;
+static uint64_t g_last_frame_ns = 0;
+static struct emu_counters g_total;
+static struct emu_counters g_interval;
+// Reset every interval; holds the last STATS_WINDOW samples of it
+static struct timing g_interval_timing;
+static struct histogram g_total_gap;
+static struct histogram g_total_delay;
+
+static uint64_t get_time_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void on_signal(int sig) { g_stop = 1; }
+
+static bool chance(int pct) { return pct > 0 && rand() % 100 < pct; }
+
+static void bump(uint64_t *total, uint64_t *interval) {
+        (*total)++;
+        (*interval)++;
+}
+
+#define COUNT(field) bump(&g_total.field, &g_interval.field)
+
+static void hist_record(struct histogram *hist, uint64_t value_ns) {
+        uint64_t bucket = value_ns / HIST_BUCKET_NS;
+        hist->buckets[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1]++;
+        hist->count++;
+        if (value_ns > hist->max_ns)
+                hist->max_ns = value_ns;
+}
+
+// Upper edge of the bucket holding the percentile, 0 if empty
+static uint64_t hist_percentile(const struct histogram *hist, int percentile) {
+        uint64_t target = (hist->count * percentile + 99) / 100;
+        uint64_t seen = 0;
+
+        if (hist->count == 0)
+                return 0;
+        if (target == 0)
+                target = 1;
+
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+                seen += hist->buckets[i];
+                if (seen >= target)
+                        return i == HIST_BUCKETS - 1 ? hist->max_ns : (i + 1) * HIST_BUCKET_NS;
+        }
+        return hist->max_ns;
+}
+
+static void boost_saturation_f(float *r, float *g, float *b, float boost) {
+        if (boost <= 1.0f)
+                return;
+
+        float max_val = fmaxf(*r, fmaxf(*g, *b));
+        float min_val = fminf(*r, fminf(*g, *b));
+        float delta = max_val - min_val;
+
+        if (delta < 0.001f)
+                return;
+
+        float h, s, v = max_val;
+        s = delta / max_val;
+
+        if (*r == max_val)
+                h = (*g - *b) / delta + (*g < *b ? 6.0f : 0.0f);
+        else if (*g == max_val)
+                h = (*b - *r) / delta + 2.0f;
+        else
+                h = (*r - *g) / delta + 4.0f;
+        h /= 6.0f;
+
+        s = fminf(s * boost, 1.0f);
+
+        int i = (int)(h * 6.0f);
+        float f = h * 6.0f - i;
+        float p = v * (1.0f - s);
+        float q = v * (1.0f - f * s);
+        float t = v * (1.0f - (1.0f - f) * s);
+
+        switch (i % 6) {
+        case 0: *r = v; *g = t; *b = p; break;
+        case 1: *r = q; *g = v; *b = p; break;
+        case 2: *r = p; *g = v; *b = t; break;
+        case 3: *r = p; *g = q; *b = v; break;
+        case 4: *r = t; *g = p; *b = v; break;
+        case 5: *r = v; *g = p; *b = q; break;
+        }
+}
+
+static bool isConfigPacket(const uint8_t *buffer, size_t size) {
+        return size >= 4 && buffer[0] == PROTO_MAGIC && buffer[1] == PROTO_CONFIG;
+}
+
+static void processConfigPacket(const uint8_t *buffer, size_t size, uint64_t now) {
+        g_brightness = buffer[2];
+
+        if (size >= PROTO_CONFIG_SIZE) {
+                memcpy(&g_saturation, &buffer[4], sizeof(float));
+                memcpy(&g_smoothing, &buffer[8], sizeof(float));
+        }
+
+        // Done on the receive task in the firmware: a new sender restarts its frame ids
+        assembly.active = false;
+        g_have_last_id = false;
+
+        // The green flash blocks the render loop, frames meanwhile are coalesced
+        g_flash_until = now + CONFIG_FLASH_MS * 1000000ULL;
+        lastFrameTime = g_flash_until;
+        currentState = STATE_ACTIVE;
+        COUNT(configs);
+
+        printf("\r[%.3f] config brightness=%u saturation=%.2f smoothing=%.2f\n",
+               (now - g_start_ns) / 1e9, g_brightness, g_saturation, g_smoothing);
+}
+
+static void enterTimeoutState(uint64_t now) {
+        if (currentState != STATE_TIMEOUT) {
+                memset(leds, 0, sizeof(leds));
+                currentState = STATE_TIMEOUT;
+                COUNT(timeouts);
+                printf("\r[%.3f] no frame for %d ms, LEDs off until the next config\n",
+                       (now - g_start_ns) / 1e9, TIMEOUT_MS);
+        }
+}
+
+// lastFrameTime lies in the future while the config flash is running
+static bool timedOut(uint64_t now) {
+        return now > lastFrameTime && now - lastFrameTime > (uint64_t)TIMEOUT_MS * 1000000ULL;
+}
+
+static void renderColors(const uint8_t *data, uint16_t ledCount) {
+        for (int i = 0; i < NUM_LEDS; i++) {
+                int srcIndex = (i * ledCount) / NUM_LEDS;
+                if (srcIndex > ledCount - 1)
+                        srcIndex = ledCount - 1;
+                int offset = srcIndex * 3;
+
+                float target_r = data[offset + 0] / 255.0f;
+                float target_g = data[offset + 1] / 255.0f;
+                float target_b = data[offset + 2] / 255.0f;
+
+                boost_saturation_f(&target_r, &target_g, &target_b, g_saturation);
+
+                if (first_frame) {
+                        smoothed_colors[i].r = target_r;
+                        smoothed_colors[i].g = target_g;
+                        smoothed_colors[i].b = target_b;
+                } else {
+                        smoothed_colors[i].r = g_smoothing * target_r +
+                                               (1.0f - g_smoothing) * smoothed_colors[i].r;
+                        smoothed_colors[i].g = g_smoothing * target_g +
+                                               (1.0f - g_smoothing) * smoothed_colors[i].g;
+                        smoothed_colors[i].b = g_smoothing * target_b +
+                                               (1.0f - g_smoothing) * smoothed_colors[i].b;
+                }
+
+                leds[i * 3 + 0] = (uint8_t)(smoothed_colors[i].r * 255.0f + 0.5f);
+                leds[i * 3 + 1] = (uint8_t)(smoothed_colors[i].g * 255.0f + 0.5f);
+                leds[i * 3 + 2] = (uint8_t)(smoothed_colors[i].b * 255.0f + 0.5f);
+        }
+        first_frame = false;
+}
+
+static void print_strip() {
+        printf("\r");
+        for (int i = 0; i < NUM_LEDS; i++) {
+                // FastLED scales by the global brightness at show() time
+                printf("\x1b[48;2;%d;%d;%dm ", leds[i * 3] * g_brightness / 255,
+                       leds[i * 3 + 1] * g_brightness / 255, leds[i * 3 + 2] * g_brightness / 255);
+        }
+        printf("\x1b[0m");
+        fflush(stdout);
+}
+
+static void write_csv(const struct FrameAssembly *frame, uint64_t shown_ns, uint64_t gap_ns) {
+        if (!g_csv)
+                return;
+
+        fprintf(g_csv, "%.6f,", (frame->rx_ns - g_start_ns) / 1e9);
+        if (shown_ns)
+                fprintf(g_csv, "%.6f", (shown_ns - g_start_ns) / 1e9);
+        fprintf(g_csv, ",%u,%u,%u,%d,%u,", frame->frameId, frame->total, frame->ledsReceived,
+                frame->ledsReceived >= frame->total, frame->flags);
+        if (shown_ns)
+                fprintf(g_csv, "%.3f", gap_ns / 1e6);
+        fprintf(g_csv, "\n");
+}
+
+static void dropFrame(const struct FrameAssembly *frame) {
+        COUNT(dropped);
+        write_csv(frame, 0, 0);
+}
+
+// The render loop of the firmware, with its checks in the same order
+static void showFrame(const struct FrameAssembly *frame, uint64_t now) {
+        if (currentState != STATE_ACTIVE) {
+                dropFrame(frame);
+                return;
+        }
+
+        if (timedOut(now)) {
+                enterTimeoutState(now);
+                return;
+        }
+
+        if (frame->flags & FRAME_FLAG_SCENE_CUT) {
+                first_frame = true;
+        }
+
+        renderColors(frame->data, frame->total);
+        lastFrameTime = now;
+
+        uint64_t gap_ns = g_last_frame_ns ? now - g_last_frame_ns : 0;
+        if (g_last_frame_ns) {
+                stats_record(&g_interval_timing.frame_gap, gap_ns);
+                hist_record(&g_total_gap, gap_ns);
+                if (gap_ns > g_interval_timing.max_gap_ns)
+                        g_interval_timing.max_gap_ns = gap_ns;
+        }
+        g_last_frame_ns = now;
+        write_csv(frame, now, gap_ns);
+
+        if (g_verbose)
+                print_strip();
+}
+
+// publishFrame() in the firmware: while the render loop is blocked only the
+// newest frame is kept, inheriting the flags of the ones it replaces
+static void publishAssembly(uint64_t now) {
+        if (assembly.published)
+                return;
+        assembly.published = true;
+
+        COUNT(frames);
+        if (assembly.ledsReceived < assembly.total)
+                COUNT(incomplete);
+
+        if (now < g_flash_until) {
+                uint8_t flags = assembly.flags;
+                if (g_held_ready) {
+                        flags |= g_held.flags;
+                        dropFrame(&g_held);
+                }
+                g_held = assembly;
+                g_held.flags = flags;
+                g_held_ready = true;
+                return;
+        }
+
+        showFrame(&assembly, now);
+}
+
+// Runs the frame held during the config flash once the render loop is free
+static void flush_held(uint64_t now) {
+        if (g_held_ready && now >= g_flash_until) {
+                g_held_ready = false;
+                showFrame(&g_held, now);
+        }
+}
+
+static uint16_t getU16(const uint8_t *src) { return src[0] | (src[1] << 8); }
+
+// Mirrors processFrameChunk() in the firmware, plus frame id gap accounting
+static void processFrameChunk(const uint8_t *buffer, size_t size, uint64_t rx_ns, uint64_t now) {
+        if (size < PROTO_FRAME_HEADER_SIZE || buffer[0] != PROTO_MAGIC ||
+            buffer[1] != PROTO_FRAME) {
+                COUNT(malformed);
+                return;
+        }
+
+        uint8_t flags = buffer[2];
+        uint8_t encoding = buffer[3];
+        uint16_t frameId = getU16(buffer + 4);
+        uint16_t offset = getU16(buffer + 6);
+        uint16_t count = getU16(buffer + 8);
+        uint16_t total = getU16(buffer + 10);
+        size_t bytesPerLed = encoding == PROTO_ENCODING_RGB565 ? 2 : 3;
+
+        if ((encoding != PROTO_ENCODING_RGB888 && encoding != PROTO_ENCODING_RGB565) ||
+            total == 0 || total > MAX_RECEIVED_LEDS || offset + count > total ||
+            size < PROTO_FRAME_HEADER_SIZE + count * bytesPerLed) {
+                COUNT(malformed);
+                return;
+        }
+
+        if (!assembly.active || frameId != assembly.frameId) {
+                int16_t age = (int16_t)(frameId - assembly.frameId);
+                if (assembly.active && age < 0 && age >= -PROTO_FRAME_ID_WINDOW) {
+                        COUNT(late_chunks);
+                        return;
+                }
+
+                // Restarted sender, its ids say nothing about frames in between
+                if (assembly.active && age < -PROTO_FRAME_ID_WINDOW) {
+                        g_have_last_id = false;
+                }
+
+                if (assembly.active && !assembly.published) {
+                        publishAssembly(now);
+                }
+
+                if (g_have_last_id && (uint16_t)(frameId - g_last_id) > 1) {
+                        g_total.missing_ids += (uint16_t)(frameId - g_last_id) - 1;
+                        g_interval.missing_ids += (uint16_t)(frameId - g_last_id) - 1;
+                }
+                g_have_last_id = true;
+                g_last_id = frameId;
+
+                assembly.frameId = frameId;
+                assembly.total = total;
+                assembly.ledsReceived = 0;
+                assembly.flags = 0;
+                assembly.rx_ns = rx_ns;
+                assembly.active = true;
+                assembly.published = false;
+        }
+
+        const uint8_t *payload = buffer + PROTO_FRAME_HEADER_SIZE;
+        uint8_t *dst = assembly.data + offset * 3;
+
+        if (encoding == PROTO_ENCODING_RGB565) {
+                for (uint16_t i = 0; i < count; i++) {
+                        uint16_t packed = getU16(payload + i * 2);
+                        uint8_t r = (packed >> 11) & 0x1F;
+                        uint8_t g = (packed >> 5) & 0x3F;
+                        uint8_t b = packed & 0x1F;
+                        dst[i * 3 + 0] = (r << 3) | (r >> 2);
+                        dst[i * 3 + 1] = (g << 2) | (g >> 4);
+                        dst[i * 3 + 2] = (b << 3) | (b >> 2);
+                }
+        } else {
+                memcpy(dst, payload, count * 3);
+        }
+
+        assembly.flags |= flags;
+        assembly.ledsReceived += count;
+
+        if (assembly.ledsReceived >= assembly.total && !assembly.published) {
+                publishAssembly(now);
+        }
+}
+
+static void deliver(const struct pending_packet *pkt, uint64_t now) {
+        stats_record(&g_interval_timing.added_delay, now - pkt->rx_ns);
+        hist_record(&g_total_delay, now - pkt->rx_ns);
+
+        if (isConfigPacket(pkt->data, pkt->len)) {
+                processConfigPacket(pkt->data, pkt->len, now);
+        } else {
+                processFrameChunk(pkt->data, pkt->len, pkt->rx_ns, now);
+        }
+}
+
+static size_t earliest_pending() {
+        size_t best = 0;
+        for (size_t i = 1; i < g_queue_len; i++) {
+                if (g_queue[i].due_ns < g_queue[best].due_ns)
+                        best = i;
+        }
+        return best;
+}
+
+static void deliver_at(size_t index, uint64_t now) {
+        deliver(&g_queue[index], now);
+        g_queue[index] = g_queue[--g_queue_len];
+}
+
+static void flush_due(uint64_t now) {
+        while (g_queue_len > 0) {
+                size_t next = earliest_pending();
+                if (g_queue[next].due_ns > now)
+                        break;
+                deliver_at(next, now);
+        }
+}
+
+static void enqueue(const uint8_t *data, size_t len, uint64_t rx_ns) {
+        if (g_queue_len == EMU_QUEUE_SIZE) {
+                // Never block the socket: hand the oldest packet over early
+                COUNT(queue_overflow);
+                deliver_at(earliest_pending(), rx_ns);
+        }
+
+        struct pending_packet *pkt = &g_queue[g_queue_len++];
+        pkt->rx_ns = rx_ns;
+        pkt->due_ns = rx_ns + g_delay_ns;
+        if (g_jitter_ns)
+                pkt->due_ns += (uint64_t)rand() % g_jitter_ns;
+        if (chance(g_reorder_pct)) {
+                pkt->due_ns += g_jitter_ns + REORDER_HOLD_NS;
+                COUNT(injected_reorder);
+        }
+        pkt->len = len;
+        memcpy(pkt->data, data, len);
+}
+
+static void receive_all(int sockfd) {
+        static uint8_t buffer[65536];
+        static struct pending_packet direct;
+
+        while (true) {
+                ssize_t len = recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT);
+                if (len < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                                perror("recv");
+                        return;
+                }
+
+                uint64_t rx_ns = get_time_ns();
+                COUNT(packets);
+
+                if (len > MAX_PACKET_SIZE) {
+                        COUNT(malformed);
+                        continue;
+                }
+
+                if (chance(g_loss_pct)) {
+                        COUNT(injected_loss);
+                        continue;
+                }
+
+                if (g_delay_ns == 0 && g_jitter_ns == 0 && g_reorder_pct == 0) {
+                        direct.rx_ns = rx_ns;
+                        direct.len = len;
+                        memcpy(direct.data, buffer, len);
+                        deliver(&direct, rx_ns);
+                } else {
+                        enqueue(buffer, len, rx_ns);
+                }
+        }
+}
+
+static const char *state_name(enum SystemState state) {
+        switch (state) {
+        case STATE_WAITING_CONFIG:
+                return "waiting";
+        case STATE_ACTIVE:
+                return "active";
+        case STATE_TIMEOUT:
+                return "timeout";
+        }
+        return "?";
+}
+
+static void print_stats(const char *label, const struct emu_counters *c, double seconds,
+                        uint64_t gap_p50, uint64_t gap_p99, uint64_t gap_max, uint64_t delay_p50,
+                        uint64_t delay_p99) {
+        printf("\r[%s] %s fps=%.1f packets=%llu frames=%llu incomplete=%llu dropped=%llu "
+               "missing=%llu late=%llu malformed=%llu configs=%llu timeouts=%llu\n",
+               label, state_name(currentState), seconds > 0 ? c->frames / seconds : 0.0,
+               (unsigned long long)c->packets, (unsigned long long)c->frames,
+               (unsigned long long)c->incomplete, (unsigned long long)c->dropped,
+               (unsigned long long)c->missing_ids, (unsigned long long)c->late_chunks,
+               (unsigned long long)c->malformed, (unsigned long long)c->configs,
+               (unsigned long long)c->timeouts);
+
+        if (gap_max > 0) {
+                printf("\r[%s] frame gap p50=%.3fms p99=%.3fms max=%.3fms\n", label, gap_p50 / 1e6,
+                       gap_p99 / 1e6, gap_max / 1e6);
+        }
+
+        if (c->injected_loss || c->injected_reorder || c->queue_overflow || g_delay_ns ||
+            g_jitter_ns) {
+                printf("\r[%s] injected loss=%llu reorder=%llu overflow=%llu delay p50=%.3fms "
+                       "p99=%.3fms\n",
+                       label, (unsigned long long)c->injected_loss,
+                       (unsigned long long)c->injected_reorder,
+                       (unsigned long long)c->queue_overflow, delay_p50 / 1e6, delay_p99 / 1e6);
+        }
+}
+
+static void print_interval(double seconds) {
+        const struct timing *t = &g_interval_timing;
+
+        print_stats("interval", &g_interval, seconds, stats_percentile(&t->frame_gap, 50),
+                    stats_percentile(&t->frame_gap, 99), t->max_gap_ns,
+                    stats_percentile(&t->added_delay, 50), stats_percentile(&t->added_delay, 99));
+}
+
+static void print_total(double seconds) {
+        print_stats("total", &g_total, seconds, hist_percentile(&g_total_gap, 50),
+                    hist_percentile(&g_total_gap, 99), g_total_gap.max_ns,
+                    hist_percentile(&g_total_delay, 50), hist_percentile(&g_total_delay, 99));
+}
+
+static void usage(const char *prog) {
+        fprintf(stderr,
+                "Usage: %s [-p port] [-l loss%%] [-d delay_ms] [-j jitter_ms] [-r reorder%%] "
+                "[-s seed] [-i interval_s] [-o frames.csv] [-v]\n",
+                prog);
+}
+
+int main(int argc, char *argv[]) {
+        uint16_t port = UDP_PORT;
+        int interval_s = 5;
+        const char *csv_path = NULL;
+        unsigned int seed = time(NULL);
+        int opt;
+
+        while ((opt = getopt(argc, argv, "p:l:d:j:r:s:i:o:v")) != -1) {
+                switch (opt) {
+                case 'p':
+                        port = atoi(optarg);
+                        break;
+                case 'l':
+                        g_loss_pct = atoi(optarg);
+                        break;
+                case 'd':
+                        g_delay_ns = (uint64_t)(atof(optarg) * 1e6);
+                        break;
+                case 'j':
+                        g_jitter_ns = (uint64_t)(atof(optarg) * 1e6);
+                        break;
+                case 'r':
+                        g_reorder_pct = atoi(optarg);
+                        break;
+                case 's':
+                        seed = strtoul(optarg, NULL, 10);
+                        break;
+                case 'i':
+                        interval_s = atoi(optarg);
+                        if (interval_s < 1)
+                                interval_s = 1;
+                        break;
+                case 'o':
+                        csv_path = optarg;
+                        break;
+                case 'v':
+                        g_verbose = true;
+                        break;
+                default:
+                        usage(argv[0]);
+                        return 1;
+                }
+        }
+
+        srand(seed);
+
+        if (csv_path) {
+                g_csv = fopen(csv_path, "w");
+                if (!g_csv) {
+                        perror(csv_path);
+                        return 1;
+                }
+                fprintf(g_csv, "rx_s,shown_s,frame_id,leds,leds_received,complete,flags,gap_ms\n");
+        }
+
+        int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sockfd < 0) {
+                perror("socket");
+                return 1;
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+        if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+                perror("bind");
+                return 1;
+        }
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_signal;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        printf("UDP listening on port %u (loss %d%%, delay %.1fms, jitter %.1fms, reorder %d%%, "
+               "seed %u)\n",
+               port, g_loss_pct, g_delay_ns / 1e6, g_jitter_ns / 1e6, g_reorder_pct, seed);
+
+        g_start_ns = get_time_ns();
+        uint64_t interval_start = g_start_ns;
+
+        while (!g_stop) {
+                uint64_t now = get_time_ns();
+                int timeout_ms = STATE_POLL_MS;
+
+                if (g_queue_len > 0) {
+                        uint64_t due = g_queue[earliest_pending()].due_ns;
+                        int due_ms = due > now ? (int)((due - now + 999999) / 1000000) : 0;
+                        if (due_ms < timeout_ms)
+                                timeout_ms = due_ms;
+                }
+
+                if (g_held_ready) {
+                        uint64_t due = g_flash_until;
+                        int due_ms = due > now ? (int)((due - now + 999999) / 1000000) : 0;
+                        if (due_ms < timeout_ms)
+                                timeout_ms = due_ms;
+                }
+
+                struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+                if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+                        perror("poll");
+                        break;
+                }
+
+                if (pfd.revents & POLLIN)
+                        receive_all(sockfd);
+
+                now = get_time_ns();
+                flush_due(now);
+                flush_held(now);
+
+                if (currentState == STATE_ACTIVE && timedOut(now)) {
+                        enterTimeoutState(now);
+                }
+
+                if (now - interval_start >= (uint64_t)interval_s * 1000000000ULL) {
+                        print_interval((now - interval_start) / 1e9);
+                        memset(&g_interval, 0, sizeof(g_interval));
+                        stats_reset(&g_interval_timing.frame_gap);
+                        stats_reset(&g_interval_timing.added_delay);
+                        g_interval_timing.max_gap_ns = 0;
+                        interval_start = now;
+                        if (g_csv)
+                                fflush(g_csv);
+                }
+        }
+
+        print_total((get_time_ns() - g_start_ns) / 1e9);
+
+        if (g_csv)
+                fclose(g_csv);
+        close(sockfd);
+        return 0;
+}
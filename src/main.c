@@ -1,8 +1,13 @@
 #include <libportal/portal.h>
 #include <math.h>
+#include <errno.h>
+#include <getopt.h>
+#include <glib-unix.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -13,16 +18,38 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
+#include "capture.h"
+#include "protocol.h"
+#include "rt.h"
+#include "shm.h"
+#include "state.h"
+#include "stats.h"
+
 #if defined(WIFI)
 #include "wifi.h"
 #endif
 
+#if defined(WLR)
+#include "wlr.h"
+#endif
+
 struct PipeWireCtx {
         struct pw_thread_loop *thread_loop;
         struct pw_context *context;
         struct pw_core *core;
+        struct spa_hook core_listener;
         struct pw_stream *stream;
         struct spa_hook stream_listener;
+        uint32_t node;
+
+        // Recovery state, only touched with the loop lock held
+        struct spa_source *recover_timer;
+        guint reopen_idle; // pending reopen_remote_idle() source, 0 if none
+        int recover_attempts;
+        bool recovering;
+        bool core_failed;
+        bool remote_reopened;
+        uint64_t recovery_start_ns;
 
         // Dynamic Resolution Trackers
         uint32_t real_width;
@@ -30,16 +57,49 @@ struct PipeWireCtx {
         uint32_t real_stride;
 } g_pw;
 
+// First retry after a stream failure; doubled per attempt up to 16x
+#define RECOVER_DELAY_NS 20000000ULL
+// Stream recreations on the same core before asking the portal for a new fd
+#define RECOVER_STREAM_RETRIES 3
+
 static void on_stream_process(void *data);
 static void on_stream_param_changed(void *data, uint32_t id, const struct spa_pod *param);
+static void schedule_recovery(struct PipeWireCtx *ctx);
+static void on_recover_timer(void *data, uint64_t expirations);
+static void request_session(void);
+static void retry_session(XdpSession *session);
 
 static void on_stream_state_changed(void *data, enum pw_stream_state old,
                                     enum pw_stream_state state, const char *error) {
+        struct PipeWireCtx *ctx = data;
+
         if (error) {
                 g_printerr("Stream error: %s\n", error);
         }
+
+        // UNCONNECTED is only reached on our own disconnect or when the node goes away
+        if (state == PW_STREAM_STATE_ERROR ||
+            (state == PW_STREAM_STATE_UNCONNECTED && old != PW_STREAM_STATE_UNCONNECTED)) {
+                schedule_recovery(ctx);
+        }
+}
+
+static void on_core_error(void *data, uint32_t id, int seq, int res, const char *message) {
+        struct PipeWireCtx *ctx = data;
+
+        g_printerr("PipeWire core error: %s\n", message);
+
+        if (id == PW_ID_CORE && res == -EPIPE) {
+                ctx->core_failed = true;
+                schedule_recovery(ctx);
+        }
 }
 
+static const struct pw_core_events core_events = {
+    PW_VERSION_CORE_EVENTS,
+    .error = on_core_error,
+};
+
 static const struct pw_stream_events stream_events = {
     PW_VERSION_STREAM_EVENTS,
     .state_changed = on_stream_state_changed,
@@ -47,11 +107,6 @@ static const struct pw_stream_events stream_events = {
     .param_changed = on_stream_param_changed,
 };
 
-#define CAPTURE_WIDTH 160
-#define CAPTURE_HEIGHT 90
-#define CAPTURE_DEPTH 10
-#define CAPTURE_FRAMES 24
-
 typedef struct {
         unsigned char r, g, b;
 } RGB;
@@ -60,16 +115,84 @@ typedef struct {
         float r, g, b;
 } ColorFloat;
 
-static RGB g_final_buffer[((CAPTURE_HEIGHT - CAPTURE_DEPTH) / CAPTURE_DEPTH + 1) +
-                          ((CAPTURE_WIDTH + CAPTURE_DEPTH - 1) / CAPTURE_DEPTH) +
-                          ((CAPTURE_HEIGHT + CAPTURE_DEPTH - 1) / CAPTURE_DEPTH)];
+// Scene cut detection: a zone "jumps" when its summed |dR|+|dG|+|dB| against the
+// previous frame exceeds SCENE_CUT_ZONE_DELTA. If at least SCENE_CUT_ZONE_PCT percent
+// of all zones jump in the same frame it is treated as a hard cut. Fades move far
+// less than this per frame at CAPTURE_FRAMES and stay smoothed.
+#define SCENE_CUT_ZONE_DELTA 120
+#define SCENE_CUT_ZONE_PCT 75
 
+static RGB g_final_buffer[NUM_ZONES];
+static RGB g_prev_buffer[NUM_ZONES];
+static bool g_prev_valid = false;
+
+static XdpPortal *g_portal;
 static XdpSession *g_session;
 
+// Restore token the current session request was made with, NULL for a fresh prompt
+static char *g_restore_token;
+
+// Session requests in a row that did not lead to a frame; the delay before the
+// next one doubles with each. Reset from the PipeWire thread, hence atomic.
+#define SESSION_RETRY_DELAY_MS 1000
+#define SESSION_RETRIES 6
+static gint g_session_retries = 0;
+static guint g_session_retry_source = 0;
+
+static GMainLoop *g_mainloop;
+static int g_exit_status = 0;
+
+// Startup timing, reported once when the first frame goes out
+static uint64_t g_startup_ns;
+static bool g_first_frame_sent = false;
+
 static int g_brightness = 150;
 static float g_saturation = 1.0f;
 static float g_smoothing = 1.0f;
 
+// Opt-in low-latency mode (-l): RT priority for the capture thread, locked
+// memory and AC_VO marking on the socket. g_pin_cpu < 0 leaves affinity alone.
+#define RT_PRIORITY 10
+static bool g_low_latency = false;
+static int g_pin_cpu = -1;
+
+// Optional (-m) shared-memory ring other local tools read the zone colours from
+static struct shm_ring *g_shm_ring = NULL;
+
+// A create/start request is in flight; further requests are refused until it ends
+static bool g_session_pending = false;
+
+// Receiver address, -H points it at blight-emu or another ESP32
+static const char *g_esp_host = "192.168.1.100";
+
+// Time from the process callback to sendto() returning, i.e. frame-to-air
+static struct latency_stats g_tx_latency;
+// Time spent in sample_edges(), to compare the averaging modes
+static struct latency_stats g_sample_latency;
+
+// Optional (-g) linear-light averaging. Samples are decoded through a 256
+// entry sRGB -> 16 bit linear table, summed, and each zone average is encoded
+// back through a 4096 entry table indexed by the top 12 bits.
+#define LINEAR_ENCODE_BITS 12
+static bool g_linear_light = false;
+static uint16_t g_srgb_to_linear[256];
+static uint8_t g_linear_to_srgb[1 << LINEAR_ENCODE_BITS];
+
+static void init_linear_tables() {
+        for (int i = 0; i < 256; i++) {
+                float c = i / 255.0f;
+                float l = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+                g_srgb_to_linear[i] = (uint16_t)(l * 65535.0f + 0.5f);
+        }
+
+        for (int i = 0; i < (1 << LINEAR_ENCODE_BITS); i++) {
+                // Centre of the bucket so rounding is symmetric
+                float l = (i + 0.5f) / (1 << LINEAR_ENCODE_BITS);
+                float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+                g_linear_to_srgb[i] = (uint8_t)(c * 255.0f + 0.5f);
+        }
+}
+
 static struct {
         bool is_bgr;
 } g_format_info = {true};
@@ -148,11 +271,53 @@ static int send_config(uint8_t brightness) {
         return 0;
 }
 
+static void average_pixel_box_linear(const unsigned char *data, size_t max_mapped_size,
+                                     int start_x, int start_y, int box_w, int box_h, int stride,
+                                     RGB *result) {
+        // 16 bit linear samples, a uint32_t holds over 65000 of them per channel
+        uint32_t total_r = 0, total_g = 0, total_b = 0;
+        int count = 0;
+        int r_off = g_format_info.is_bgr ? 2 : 0;
+        int b_off = g_format_info.is_bgr ? 0 : 2;
+
+        for (int dy = 0; dy < box_h; dy += CAPTURE_DEPTH) {
+                int current_y = start_y + dy;
+                if ((size_t)(current_y * stride) >= max_mapped_size)
+                        break;
+
+                const unsigned char *row = data + (current_y * stride);
+
+                for (int dx = 0; dx < box_w; dx += CAPTURE_DEPTH) {
+                        size_t byte_offset = (start_x + dx) * 4;
+                        if ((size_t)(current_y * stride) + byte_offset + 3 >= max_mapped_size)
+                                break;
+
+                        const unsigned char *px = row + byte_offset;
+                        total_r += g_srgb_to_linear[px[r_off]];
+                        total_g += g_srgb_to_linear[px[1]];
+                        total_b += g_srgb_to_linear[px[b_off]];
+                        count++;
+                }
+        }
+
+        if (count == 0)
+                count = 1;
+        result->r = g_linear_to_srgb[(total_r / count) >> (16 - LINEAR_ENCODE_BITS)];
+        result->g = g_linear_to_srgb[(total_g / count) >> (16 - LINEAR_ENCODE_BITS)];
+        result->b = g_linear_to_srgb[(total_b / count) >> (16 - LINEAR_ENCODE_BITS)];
+}
+
 static void average_pixel_box(const unsigned char *data, size_t max_mapped_size, int start_x,
                               int start_y, int box_w, int box_h, int stride, RGB *result) {
         unsigned int total_r = 0, total_g = 0, total_b = 0;
         int count = 0;
 
+        if (g_linear_light) {
+                average_pixel_box_linear(data, max_mapped_size, start_x, start_y, box_w, box_h,
+                                         stride, result);
+                return;
+        }
+
         if (g_format_info.is_bgr) {
                 for (int dy = 0; dy < box_h; dy += CAPTURE_DEPTH) {
                         int current_y = start_y + dy;
@@ -204,6 +369,130 @@ static void average_pixel_box(const unsigned char *data, size_t max_mapped_size,
         result->b = total_b / count;
 }
 
+static bool detect_scene_cut() {
+        int jumped = 0;
+
+        if (!g_prev_valid) {
+                memcpy(g_prev_buffer, g_final_buffer, sizeof(g_final_buffer));
+                g_prev_valid = true;
+                return false;
+        }
+
+        for (int i = 0; i < NUM_ZONES; i++) {
+                int delta = abs(g_final_buffer[i].r - g_prev_buffer[i].r) +
+                            abs(g_final_buffer[i].g - g_prev_buffer[i].g) +
+                            abs(g_final_buffer[i].b - g_prev_buffer[i].b);
+                if (delta > SCENE_CUT_ZONE_DELTA)
+                        jumped++;
+        }
+
+        memcpy(g_prev_buffer, g_final_buffer, sizeof(g_final_buffer));
+
+        return jumped * 100 >= NUM_ZONES * SCENE_CUT_ZONE_PCT;
+}
+
+static void sample_edges(const struct edge_source *left, const struct edge_source *top,
+                         const struct edge_source *right, uint32_t width, uint32_t height) {
+        uint64_t start = get_time_ns();
+
+        memset(g_final_buffer, 0, sizeof(g_final_buffer));
+        int buffer_index = 0;
+
+        int real_box_w = (CAPTURE_DEPTH * width) / CAPTURE_WIDTH;
+        int real_box_h = (CAPTURE_DEPTH * height) / CAPTURE_HEIGHT;
+        if (real_box_w < 1)
+                real_box_w = 1;
+        if (real_box_h < 1)
+                real_box_h = 1;
+
+        // 1. LEFT EDGE: Bottom to top
+        for (int y = CAPTURE_HEIGHT - CAPTURE_DEPTH; y >= 0; y -= CAPTURE_DEPTH) {
+                int real_x = 0;
+                int real_y = (y * height) / CAPTURE_HEIGHT;
+
+                average_pixel_box(left->data, left->size, real_x - left->origin_x,
+                                  real_y - left->origin_y, real_box_w, real_box_h, left->stride,
+                                  &g_final_buffer[buffer_index++]);
+        }
+
+        // 2. TOP EDGE: Left to right
+        for (int x = 0; x < CAPTURE_WIDTH; x += CAPTURE_DEPTH) {
+                int real_x = (x * width) / CAPTURE_WIDTH;
+                int real_y = 0;
+
+                average_pixel_box(top->data, top->size, real_x - top->origin_x,
+                                  real_y - top->origin_y, real_box_w, real_box_h, top->stride,
+                                  &g_final_buffer[buffer_index++]);
+        }
+
+        // 3. RIGHT EDGE: Top to bottom
+        for (int y = 0; y < CAPTURE_HEIGHT; y += CAPTURE_DEPTH) {
+                int real_x = ((CAPTURE_WIDTH - CAPTURE_DEPTH) * width) / CAPTURE_WIDTH;
+                int real_y = (y * height) / CAPTURE_HEIGHT;
+
+                average_pixel_box(right->data, right->size, real_x - right->origin_x,
+                                  real_y - right->origin_y, real_box_w, real_box_h, right->stride,
+                                  &g_final_buffer[buffer_index++]);
+        }
+
+        stats_record(&g_sample_latency, get_time_ns() - start);
+}
+
+static void publish_frame(uint64_t now) {
+        int num_leds = sizeof(g_final_buffer) / sizeof(RGB);
+        bool scene_cut = detect_scene_cut();
+
+        if (g_shm_ring) {
+                shm_ring_publish(g_shm_ring, (uint8_t *)g_final_buffer, num_leds,
+                                 scene_cut ? FRAME_FLAG_SCENE_CUT : 0, now);
+        }
+
+#ifdef DEBUG
+        if (scene_cut) {
+                printf("\r[FRAME] Scene cut\n");
+        }
+
+        // PRINT TO TERMINAL
+        printf("\r");
+        for (int i = 0; i < num_leds; i++) {
+                printf("\x1b[48;2;%d;%d;%dm  ", g_final_buffer[i].r, g_final_buffer[i].g,
+                       g_final_buffer[i].b);
+        }
+        printf("\x1b[0m"); // reset color
+        fflush(stdout);
+#endif
+
+#if defined(WIFI)
+        ssize_t tx_res = wifi_tx_frame((uint8_t *)g_final_buffer, num_leds,
+                                       scene_cut ? FRAME_FLAG_SCENE_CUT : 0);
+#ifdef DEBUG
+        if (tx_res < 0) {
+                printf("\r[FRAME] Transmission error\n");
+        }
+#endif
+#endif
+
+        stats_record(&g_tx_latency, get_time_ns() - now);
+#ifdef DEBUG
+        if (g_tx_latency.next == 0) {
+                printf("\r[LATENCY] frame-to-air p50=%.3fms p99=%.3fms (%s)\n",
+                       stats_percentile(&g_tx_latency, 50) / 1e6,
+                       stats_percentile(&g_tx_latency, 99) / 1e6,
+                       g_low_latency ? "low-latency" : "default");
+                printf("\r[LATENCY] sampling p50=%.1fus p99=%.1fus (%s)\n",
+                       stats_percentile(&g_sample_latency, 50) / 1e3,
+                       stats_percentile(&g_sample_latency, 99) / 1e3,
+                       g_linear_light ? "linear light" : "gamma encoded");
+        }
+#endif
+
+        if (!g_first_frame_sent) {
+                g_first_frame_sent = true;
+                g_print("First LED frame %.1f ms after startup\n",
+                        (get_time_ns() - g_startup_ns) / 1e6);
+        }
+}
+
 static void on_stream_process(void *data) {
         struct PipeWireCtx *ctx = data;
         struct pw_buffer *pw_buf;
@@ -274,65 +563,8 @@ static void on_stream_process(void *data) {
                         }
                 }
 
-                memset(g_final_buffer, 0, sizeof(g_final_buffer));
-                int buffer_index = 0;
-
-                int real_box_w = (CAPTURE_DEPTH * ctx->real_width) / CAPTURE_WIDTH;
-                int real_box_h = (CAPTURE_DEPTH * ctx->real_height) / CAPTURE_HEIGHT;
-                if (real_box_w < 1)
-                        real_box_w = 1;
-                if (real_box_h < 1)
-                        real_box_h = 1;
-
-                // 1. LEFT EDGE: Bottom to top
-                for (int y = CAPTURE_HEIGHT - CAPTURE_DEPTH; y >= 0; y -= CAPTURE_DEPTH) {
-                        int real_x = 0;
-                        int real_y = (y * ctx->real_height) / CAPTURE_HEIGHT;
-
-                        average_pixel_box(raw_pixels, size, real_x, real_y, real_box_w, real_box_h,
-                                          current_stride, &g_final_buffer[buffer_index++]);
-                }
-
-                // 2. TOP EDGE: Left to right
-                for (int x = 0; x < CAPTURE_WIDTH; x += CAPTURE_DEPTH) {
-                        int real_x = (x * ctx->real_width) / CAPTURE_WIDTH;
-                        int real_y = 0;
-
-                        average_pixel_box(raw_pixels, size, real_x, real_y, real_box_w, real_box_h,
-                                          current_stride, &g_final_buffer[buffer_index++]);
-                }
-
-                // 3. RIGHT EDGE: Top to bottom
-                for (int y = 0; y < CAPTURE_HEIGHT; y += CAPTURE_DEPTH) {
-                        int real_x =
-                            ((CAPTURE_WIDTH - CAPTURE_DEPTH) * ctx->real_width) / CAPTURE_WIDTH;
-                        int real_y = (y * ctx->real_height) / CAPTURE_HEIGHT;
-
-                        average_pixel_box(raw_pixels, size, real_x, real_y, real_box_w, real_box_h,
-                                          current_stride, &g_final_buffer[buffer_index++]);
-                }
-
-                int num_leds = sizeof(g_final_buffer) / sizeof(RGB);
-
-#ifdef DEBUG
-                // PRINT TO TERMINAL
-                printf("\r");
-                for (int i = 0; i < num_leds; i++) {
-                        printf("\x1b[48;2;%d;%d;%dm  ", g_final_buffer[i].r, g_final_buffer[i].g,
-                               g_final_buffer[i].b);
-                }
-                printf("\x1b[0m"); // reset color
-                fflush(stdout);
-#endif
-
-#if defined(WIFI)
-                ssize_t tx_res = wifi_tx((uint8_t *)g_final_buffer, sizeof(g_final_buffer));
-#ifdef DEBUG
-                if (tx_res < 0) {
-                        printf("\r[FRAME] Transmission error\n");
-                }
-#endif
-#endif
+                struct edge_source full = {raw_pixels, size, current_stride, 0, 0};
+                sample_edges(&full, &full, &full, ctx->real_width, ctx->real_height);
 
                 if (buf->datas[0].type == SPA_DATA_DmaBuf && fd != -1) {
                         sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
@@ -341,6 +573,17 @@ static void on_stream_process(void *data) {
                         sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
                         ioctl(buf->datas[0].fd, DMA_BUF_IOCTL_SYNC, &sync);
                 }
+
+                publish_frame(now);
+
+                if (ctx->recovering) {
+                        ctx->recovering = false;
+                        ctx->recover_attempts = 0;
+                        ctx->remote_reopened = false;
+                        g_atomic_int_set(&g_session_retries, 0);
+                        g_print("\nStream recovered in %.1f ms\n",
+                                (now - ctx->recovery_start_ns) / 1e6);
+                }
         }
 
         pw_stream_queue_buffer(ctx->stream, pw_buf);
@@ -370,6 +613,7 @@ static void on_stream_param_changed(void *data, uint32_t id, const struct spa_po
         ctx->real_stride = ctx->real_width * 4;
 
         clear_mmap_cache();
+        g_prev_valid = false;
 
 #ifdef DEBUG
         g_print("\nScreen Capture Active: Natively sampling at %dx%d (Format: %s)\n",
@@ -378,37 +622,39 @@ static void on_stream_param_changed(void *data, uint32_t id, const struct spa_po
 #endif
 }
 
-static void start_session_cb(GObject *source, GAsyncResult *res, gpointer data) {
-        XdpSession *session = XDP_SESSION(source);
-        GError *error = NULL;
+static void apply_realtime_settings(void) {
+        pid_t tid = rt_gettid();
 
-        if (!xdp_session_start_finish(session, res, &error)) {
-                g_printerr("Start session failed: %s\n", error->message);
-                g_error_free(error);
-                return;
-        }
-
-        GVariant *streams = xdp_session_get_streams(session);
-        int node = 0;
-
-        if (streams) {
-                GVariantIter iter;
-                g_variant_iter_init(&iter, streams);
-                GVariant *options;
-                g_variant_iter_next(&iter, "(u@a{sv})", &node, &options);
+        if (g_low_latency) {
+                if (rt_make_thread_realtime(tid, RT_PRIORITY) == 0) {
 #ifdef DEBUG
-                g_print("PipeWire Node: %d\n", node);
+                        printf("Capture thread %d running SCHED_FIFO/%d\n", tid, RT_PRIORITY);
 #endif
-                g_variant_unref(options);
+                } else {
+                        g_printerr("Could not get real-time priority for the capture thread\n");
+                }
+
+                if (rt_lock_memory() == -1) {
+                        g_printerr("Could not lock memory, page faults may hit the capture path\n");
+                }
         }
 
-        int fd = xdp_session_open_pipewire_remote(session);
+        if (g_pin_cpu >= 0 && rt_pin_thread(tid, g_pin_cpu) == 0) {
 #ifdef DEBUG
-        g_print("PipeWire FD: %d\n", fd);
+                printf("Capture thread pinned to CPU %d\n", g_pin_cpu);
 #endif
+        }
+}
 
+static int setup_realtime_thread(struct spa_loop *loop, bool async, uint32_t seq,
+                                 const void *data, size_t size, void *user_data) {
+        apply_realtime_settings();
+        return 0;
+}
+
+static void setup_output(void) {
 #if defined(WIFI)
-        if (wifi_init("192.168.1.100", 4210, 1000) == -1) {
+        if (wifi_init(g_esp_host, 4210, 1000) == -1) {
 #ifdef DEBUG
                 printf("No device found\n");
 #endif
@@ -423,26 +669,23 @@ static void start_session_cb(GObject *source, GAsyncResult *res, gpointer data)
 #ifdef DEBUG
         printf("Config sent: brightness=%d\n", g_brightness);
 #endif
-#endif
-
-        pw_init(NULL, NULL);
-
-        g_pw.thread_loop = pw_thread_loop_new("pipewire-render-thread", NULL);
-        struct pw_loop *loop = pw_thread_loop_get_loop(g_pw.thread_loop);
-
-        g_pw.context = pw_context_new(loop, NULL, 0);
-        g_pw.core = pw_context_connect_fd(g_pw.context, fd, NULL, 0);
-        if (!g_pw.core) {
-                g_printerr("Failed to connect to PipeWire remote FD\n");
-                return;
+        if (g_low_latency && wifi_set_low_latency() == -1) {
+                g_printerr("Could not mark socket for the WMM voice queue\n");
         }
+#endif
+}
 
-        g_pw.stream =
-            pw_stream_new(g_pw.core, "screencast-capture",
+static int connect_stream(struct PipeWireCtx *ctx) {
+        ctx->stream =
+            pw_stream_new(ctx->core, "screencast-capture",
                           pw_properties_new(PW_KEY_MEDIA_TYPE, "Video", PW_KEY_MEDIA_CATEGORY,
                                             "Capture", PW_KEY_MEDIA_ROLE, "Screen", NULL));
+        if (!ctx->stream) {
+                g_printerr("Failed to create PipeWire stream\n");
+                return -1;
+        }
 
-        pw_stream_add_listener(g_pw.stream, &g_pw.stream_listener, &stream_events, &g_pw);
+        pw_stream_add_listener(ctx->stream, &ctx->stream_listener, &stream_events, ctx);
 
         uint8_t buffer[2048];
         struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
@@ -471,20 +714,183 @@ static void start_session_cb(GObject *source, GAsyncResult *res, gpointer data)
             NULL);
 
         int res_conn =
-            pw_stream_connect(g_pw.stream, PW_DIRECTION_INPUT, node,
+            pw_stream_connect(ctx->stream, PW_DIRECTION_INPUT, ctx->node,
                               PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS, params, 2);
 
         if (res_conn < 0) {
                 g_printerr("Stream connection failed\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+// Drops the stream and every mapping of its buffers. Caller holds the loop lock.
+static void destroy_stream(struct PipeWireCtx *ctx) {
+        if (!ctx->stream)
+                return;
+
+        spa_hook_remove(&ctx->stream_listener);
+        pw_stream_disconnect(ctx->stream);
+        pw_stream_destroy(ctx->stream);
+        ctx->stream = NULL;
+
+        clear_mmap_cache();
+        ctx->real_width = 0;
+        ctx->real_height = 0;
+        g_prev_valid = false;
+}
+
+static int connect_core(struct PipeWireCtx *ctx, int fd) {
+        ctx->core = pw_context_connect_fd(ctx->context, fd, NULL, 0);
+        if (!ctx->core) {
+                g_printerr("Failed to connect to PipeWire remote FD\n");
+                return -1;
+        }
+
+        ctx->core_failed = false;
+        pw_core_add_listener(ctx->core, &ctx->core_listener, &core_events, ctx);
+        return 0;
+}
+
+static void destroy_core(struct PipeWireCtx *ctx) {
+        if (!ctx->core)
+                return;
+
+        spa_hook_remove(&ctx->core_listener);
+        pw_core_disconnect(ctx->core);
+        ctx->core = NULL;
+}
+
+static void start_session_cb(GObject *source, GAsyncResult *res, gpointer data) {
+        XdpSession *session = XDP_SESSION(source);
+        GError *error = NULL;
+
+        g_session_pending = false;
+
+        if (!xdp_session_start_finish(session, res, &error)) {
+                g_printerr("Start session failed: %s\n", error->message);
+                // The user closed the picker, nothing to retry
+                bool cancelled = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+                g_error_free(error);
+
+                if (!cancelled) {
+                        retry_session(session);
+                }
                 return;
         }
 
+        // Tokens are single use, the portal hands out a fresh one per session
+        char *token = xdp_session_get_restore_token(session);
+        if (token) {
+                state_save_restore_token(token);
+                g_free(token);
+        }
+
+        GVariant *streams = xdp_session_get_streams(session);
+        int node = 0;
+
+        if (streams) {
+                GVariantIter iter;
+                g_variant_iter_init(&iter, streams);
+                GVariant *options;
+                g_variant_iter_next(&iter, "(u@a{sv})", &node, &options);
+#ifdef DEBUG
+                g_print("PipeWire Node: %d\n", node);
+#endif
+                g_variant_unref(options);
+        }
+
+        int fd = xdp_session_open_pipewire_remote(session);
+#ifdef DEBUG
+        g_print("PipeWire FD: %d\n", fd);
+#endif
+
+        g_pw.node = node;
+
+        // Session recreated by the recovery path: the loop is already running.
+        // Drop whatever is left of the old connection before hooking up the new one.
+        if (g_pw.thread_loop) {
+                pw_thread_loop_lock(g_pw.thread_loop);
+                destroy_stream(&g_pw);
+                destroy_core(&g_pw);
+                // A new session starts the escalation over from the stream retries
+                g_pw.recover_attempts = 0;
+                g_pw.remote_reopened = false;
+                // Anything failing here is left to the recovery timer, which
+                // escalates to a new remote fd or session as usual
+                if (fd < 0 || connect_core(&g_pw, fd) == -1 || connect_stream(&g_pw) == -1) {
+                        g_printerr("Failed to connect the new screencast session\n");
+                        schedule_recovery(&g_pw);
+                }
+                pw_thread_loop_unlock(g_pw.thread_loop);
+                return;
+        }
+
+        g_atomic_int_set(&g_session_retries, 0);
+
+        setup_output();
+
+        pw_init(NULL, NULL);
+
+        g_pw.thread_loop = pw_thread_loop_new("pipewire-render-thread", NULL);
+        struct pw_loop *loop = pw_thread_loop_get_loop(g_pw.thread_loop);
+
+        g_pw.context = pw_context_new(loop, NULL, 0);
+        if (connect_core(&g_pw, fd) == -1) {
+                return;
+        }
+
+        if (connect_stream(&g_pw) == -1) {
+                return;
+        }
+
+        g_pw.recover_timer = pw_loop_add_timer(loop, on_recover_timer, &g_pw);
+
         pw_thread_loop_start(g_pw.thread_loop);
+
+        if (g_low_latency || g_pin_cpu >= 0) {
+                pw_loop_invoke(loop, setup_realtime_thread, 0, NULL, 0, false, NULL);
+        }
 #ifdef DEBUG
         g_print("PipeWire stream processing thread started natively.\n");
 #endif
 }
 
+static void on_session_closed(XdpSession *session, gpointer data) {
+        // Sessions dropped by the recovery path are already being replaced
+        if (session != g_session)
+                return;
+
+        g_printerr("Screencast session closed, requesting a new one\n");
+
+        if (g_pw.thread_loop) {
+                pw_thread_loop_lock(g_pw.thread_loop);
+                // A stream error usually armed the recovery timer first. Its
+                // escalation would request a second session, so disarm it.
+                if (g_pw.recover_timer) {
+                        pw_loop_update_timer(pw_thread_loop_get_loop(g_pw.thread_loop),
+                                             g_pw.recover_timer, NULL, NULL, false);
+                }
+                if (g_pw.reopen_idle) {
+                        g_source_remove(g_pw.reopen_idle);
+                        g_pw.reopen_idle = 0;
+                }
+                destroy_stream(&g_pw);
+                destroy_core(&g_pw);
+                if (!g_pw.recovering) {
+                        g_pw.recovering = true;
+                        g_pw.recovery_start_ns = get_time_ns();
+                }
+                pw_thread_loop_unlock(g_pw.thread_loop);
+        }
+
+        g_session = NULL;
+        g_object_unref(session);
+
+        retry_session(NULL);
+}
+
 static void create_session_cb(GObject *source, GAsyncResult *res, gpointer data) {
         XdpPortal *portal = XDP_PORTAL(source);
         GError *error = NULL;
@@ -493,6 +899,9 @@ static void create_session_cb(GObject *source, GAsyncResult *res, gpointer data)
         if (error) {
                 g_printerr("Create session failed: %s\n", error->message);
                 g_error_free(error);
+                g_session_pending = false;
+
+                retry_session(NULL);
                 return;
         }
 
@@ -500,11 +909,223 @@ static void create_session_cb(GObject *source, GAsyncResult *res, gpointer data)
         g_print("Session created\n");
 #endif
         g_session = session;
+        g_signal_connect(session, "closed", G_CALLBACK(on_session_closed), NULL);
 
         xdp_session_start(session, NULL, NULL, start_session_cb, NULL);
 }
 
-int main(int argc, const char *argv[]) {
+static void request_session(void) {
+        if (g_session_pending) {
+#ifdef DEBUG
+                g_print("Screencast session request already in flight\n");
+#endif
+                return;
+        }
+        g_session_pending = true;
+
+        g_free(g_restore_token);
+        g_restore_token = state_load_restore_token();
+
+#ifdef DEBUG
+        g_print(g_restore_token ? "Restoring previous screencast session\n"
+                                : "No restore token, the portal will ask for a screen\n");
+#endif
+
+        xdp_portal_create_screencast_session(g_portal, XDP_OUTPUT_MONITOR, XDP_SCREENCAST_FLAG_NONE,
+                                             XDP_CURSOR_MODE_HIDDEN, XDP_PERSIST_MODE_PERSISTENT,
+                                             g_restore_token, NULL, create_session_cb, NULL);
+}
+
+static gboolean session_retry_cb(gpointer data) {
+        g_session_retry_source = 0;
+        request_session();
+        return G_SOURCE_REMOVE;
+}
+
+// Replaces a session that failed to start, was closed by the portal or no
+// longer gets a stream going. The restore token is kept: the portal ignores a
+// token it does not know and shows the picker by itself, so a failure here is
+// e.g. the compositor or PipeWire restarting.
+static void retry_session(XdpSession *session) {
+        if (session && session == g_session) {
+                g_session = NULL;
+                xdp_session_close(session);
+                g_object_unref(session);
+        }
+
+        if (g_session_retry_source)
+                return;
+
+        int retries = g_atomic_int_get(&g_session_retries);
+        if (retries >= SESSION_RETRIES) {
+                g_printerr("No working screencast session after %d attempts, giving up\n",
+                           retries + 1);
+                g_exit_status = 1;
+                g_main_loop_quit(g_mainloop);
+                return;
+        }
+
+        guint delay_ms = SESSION_RETRY_DELAY_MS << retries;
+        g_atomic_int_inc(&g_session_retries);
+        g_printerr("Requesting a new screencast session in %u ms (attempt %d of %d)\n", delay_ms,
+                   retries + 1, SESSION_RETRIES);
+        g_session_retry_source = g_timeout_add(delay_ms, session_retry_cb, NULL);
+}
+
+// Runs on the GLib main thread. The first escalation gets a new remote fd from
+// the existing portal session; if the stream still fails after that, the
+// session itself is replaced.
+static gboolean reopen_remote_idle(gpointer data) {
+        struct PipeWireCtx *ctx = data;
+
+        pw_thread_loop_lock(ctx->thread_loop);
+        ctx->reopen_idle = 0;
+        bool reopen = !ctx->remote_reopened && g_session != NULL;
+        destroy_stream(ctx);
+        destroy_core(ctx);
+        pw_thread_loop_unlock(ctx->thread_loop);
+
+        int fd = reopen ? xdp_session_open_pipewire_remote(g_session) : -1;
+
+        if (fd >= 0) {
+                pw_thread_loop_lock(ctx->thread_loop);
+                ctx->remote_reopened = true;
+                ctx->recover_attempts = 0;
+                if (connect_core(ctx, fd) == 0 && connect_stream(ctx) == 0) {
+                        pw_thread_loop_unlock(ctx->thread_loop);
+                        g_printerr("Reconnected to PipeWire on the existing portal session\n");
+                        return G_SOURCE_REMOVE;
+                }
+                destroy_stream(ctx);
+                destroy_core(ctx);
+                pw_thread_loop_unlock(ctx->thread_loop);
+        }
+
+        g_printerr("Portal session unusable, replacing it\n");
+        retry_session(g_session);
+        return G_SOURCE_REMOVE;
+}
+
+// Runs on the PipeWire loop. Recreates the stream on the existing core a few
+// times, then escalates to a new remote fd from the portal.
+static void on_recover_timer(void *data, uint64_t expirations) {
+        struct PipeWireCtx *ctx = data;
+
+        if (!ctx->recovering)
+                return;
+
+        ctx->recover_attempts++;
+
+        if (ctx->core && !ctx->core_failed && ctx->recover_attempts <= RECOVER_STREAM_RETRIES) {
+#ifdef DEBUG
+                g_print("\nRecreating stream (attempt %d)\n", ctx->recover_attempts);
+#endif
+                destroy_stream(ctx);
+                if (connect_stream(ctx) == 0)
+                        return;
+        }
+
+        if (!ctx->reopen_idle)
+                ctx->reopen_idle = g_idle_add(reopen_remote_idle, ctx);
+}
+
+static void schedule_recovery(struct PipeWireCtx *ctx) {
+        if (!ctx->recovering) {
+                ctx->recovering = true;
+                ctx->recover_attempts = 0;
+                ctx->recovery_start_ns = get_time_ns();
+        }
+
+        if (!ctx->recover_timer)
+                return;
+
+        // Back off a little with every attempt so a flapping node is not hammered
+        int shift = ctx->recover_attempts < 4 ? ctx->recover_attempts : 4;
+        uint64_t delay_ns = RECOVER_DELAY_NS << shift;
+        struct timespec value = {delay_ns / 1000000000ULL, delay_ns % 1000000000ULL};
+        pw_loop_update_timer(pw_thread_loop_get_loop(ctx->thread_loop), ctx->recover_timer, &value,
+                             NULL, false);
+}
+
+// Unlinks the ring and marks the writer gone, so readers do not keep
+// waiting on a segment nobody updates any more
+static void destroy_shm_ring(void) {
+        shm_ring_destroy(g_shm_ring);
+        g_shm_ring = NULL;
+}
+
+static gboolean on_quit_signal(gpointer data) {
+        g_main_loop_quit(data);
+        return G_SOURCE_REMOVE;
+}
+
+#if defined(WLR)
+static void on_wlr_stop_signal(int sig) { wlr_capture_stop(); }
+
+static void on_wlr_frame(const struct edge_source *left, const struct edge_source *top,
+                         const struct edge_source *right, uint32_t width, uint32_t height,
+                         bool is_bgr, uint64_t timestamp_ns) {
+        g_format_info.is_bgr = is_bgr;
+        sample_edges(left, top, right, width, height);
+        publish_frame(timestamp_ns);
+}
+#endif
+
+static void usage(const char *prog) {
+        fprintf(stderr,
+                "Usage: %s [-l] [-c cpu] [-m] [-e rgb888|rgb565] [-w] [-g] [-H host] "
+                "[brightness] [saturation] [smoothing]\n",
+                prog);
+}
+
+int main(int argc, char *argv[]) {
+        g_startup_ns = get_time_ns();
+
+        bool use_wlr = false;
+        bool use_shm = false;
+        int opt;
+        while ((opt = getopt(argc, argv, "lc:me:wgH:")) != -1) {
+                switch (opt) {
+                case 'l':
+                        g_low_latency = true;
+                        break;
+                case 'c':
+                        g_pin_cpu = atoi(optarg);
+                        break;
+                case 'm':
+                        use_shm = true;
+                        break;
+                case 'e':
+#if defined(WIFI)
+                        if (strcmp(optarg, "rgb565") == 0) {
+                                wifi_set_encoding(PROTO_ENCODING_RGB565);
+                        } else if (strcmp(optarg, "rgb888") == 0) {
+                                wifi_set_encoding(PROTO_ENCODING_RGB888);
+                        } else {
+                                usage(argv[0]);
+                                return 1;
+                        }
+#endif
+                        break;
+                case 'w':
+                        use_wlr = true;
+                        break;
+                case 'g':
+                        g_linear_light = true;
+                        init_linear_tables();
+                        break;
+                case 'H':
+                        g_esp_host = optarg;
+                        break;
+                default:
+                        usage(argv[0]);
+                        return 1;
+                }
+        }
+
+        argc -= optind - 1;
+        argv += optind - 1;
+
         if (argc >= 2) {
                 g_brightness = atoi(argv[1]);
         }
@@ -519,14 +1140,44 @@ int main(int argc, const char *argv[]) {
                         g_smoothing = 1.0f;
         }
 
-        GMainLoop *loop = g_main_loop_new(NULL, FALSE);
-        XdpPortal *portal = xdp_portal_new();
+        // Created only once the options are valid so a usage error leaves no segment behind
+        if (use_shm) {
+                g_shm_ring = shm_ring_create();
+                if (!g_shm_ring) {
+                        return 1;
+                }
+                atexit(destroy_shm_ring);
+        }
 
-        xdp_portal_create_screencast_session(portal, XDP_OUTPUT_MONITOR, XDP_SCREENCAST_FLAG_NONE,
-                                             XDP_CURSOR_MODE_HIDDEN, XDP_PERSIST_MODE_TRANSIENT,
-                                             NULL, NULL, create_session_cb, NULL);
+        if (use_wlr) {
+#if defined(WLR)
+                struct sigaction sa = {.sa_handler = on_wlr_stop_signal};
+                sigaction(SIGINT, &sa, NULL);
+                sigaction(SIGTERM, &sa, NULL);
+
+                setup_output();
+                apply_realtime_settings();
+                return wlr_capture_run(on_wlr_frame) == 0 ? 0 : 1;
+#else
+                g_printerr("Built without wlroots support, rebuild with make WLR=1\n");
+                return 1;
+#endif
+        }
 
-        g_main_loop_run(loop);
+        g_mainloop = g_main_loop_new(NULL, FALSE);
+        g_portal = xdp_portal_new();
 
-        return 0;
+        g_unix_signal_add(SIGINT, on_quit_signal, g_mainloop);
+        g_unix_signal_add(SIGTERM, on_quit_signal, g_mainloop);
+
+        request_session();
+
+        g_main_loop_run(g_mainloop);
+
+        // Stop the capture thread before atexit handlers unmap what it writes to
+        if (g_pw.thread_loop) {
+                pw_thread_loop_stop(g_pw.thread_loop);
+        }
+
+        return g_exit_status;
 }
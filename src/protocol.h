@@ -0,0 +1,34 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// Wire format shared with esp32/main/main.ino. Keep both in sync.
+
+// Config: FF AA <brightness> 00 <saturation f32> <smoothing f32>
+#define PROTO_MAGIC 0xFF
+#define PROTO_CONFIG 0xAA
+#define PROTO_CONFIG_SIZE 12
+
+// Frame chunk: FF BB <flags> <encoding> <frame id u16> <offset u16> <count u16> <total u16>
+// followed by `count` LEDs in `encoding`. All integers are little-endian and
+// offset/count/total are in LEDs. Each chunk fits one unfragmented datagram and
+// can be applied on its own, so a lost chunk only leaves its LEDs stale.
+#define PROTO_FRAME 0xBB
+#define PROTO_FRAME_HEADER_SIZE 12
+
+// Frame ids restart at 0 with every sender. Receivers drop chunks at most this
+// many frames behind the current one as late and treat a larger backwards jump
+// as a new stream. A config packet also starts a new stream.
+#define PROTO_FRAME_ID_WINDOW 32
+
+#define PROTO_ENCODING_RGB888 0
+#define PROTO_ENCODING_RGB565 1
+
+#define FRAME_FLAG_SCENE_CUT 0x01
+
+// Largest UDP payload that avoids fragmentation on a 1500 byte Ethernet/WiFi MTU
+#define PROTO_DEFAULT_PAYLOAD 1472
+// Receive buffer size of the firmware; larger datagrams are dropped as malformed
+// even when the path MTU (loopback, jumbo frames) would allow them
+#define PROTO_MAX_PAYLOAD 2048
+
+#endif
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <gio/gio.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "rt.h"
+
+#define RTKIT_SERVICE "org.freedesktop.RealtimeKit1"
+#define RTKIT_PATH "/org/freedesktop/RealtimeKit1"
+
+// rtkit refuses threads without an RLIMIT_RTTIME, so a runaway RT thread
+// gets SIGXCPU instead of locking up the machine.
+#define RT_TIME_LIMIT_US 200000
+
+pid_t rt_gettid(void) { return (pid_t)syscall(SYS_gettid); }
+
+static int rtkit_make_thread_realtime(pid_t tid, int priority) {
+        GError *error = NULL;
+
+        struct rlimit rl = {RT_TIME_LIMIT_US, RT_TIME_LIMIT_US};
+        if (setrlimit(RLIMIT_RTTIME, &rl) < 0) {
+                perror("setrlimit RLIMIT_RTTIME");
+                return -1;
+        }
+
+        GDBusConnection *bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+        if (!bus) {
+                fprintf(stderr, "rtkit: system bus unavailable: %s\n", error->message);
+                g_error_free(error);
+                return -1;
+        }
+
+        GVariant *reply = g_dbus_connection_call_sync(
+            bus, RTKIT_SERVICE, RTKIT_PATH, RTKIT_SERVICE, "MakeThreadRealtime",
+            g_variant_new("(tu)", (guint64)tid, (guint32)priority), NULL, G_DBUS_CALL_FLAGS_NONE,
+            -1, NULL, &error);
+        g_object_unref(bus);
+
+        if (!reply) {
+                fprintf(stderr, "rtkit: MakeThreadRealtime failed: %s\n", error->message);
+                g_error_free(error);
+                return -1;
+        }
+
+        g_variant_unref(reply);
+        return 0;
+}
+
+int rt_make_thread_realtime(pid_t tid, int priority) {
+        struct sched_param param = {.sched_priority = priority};
+
+        if (sched_setscheduler(tid, SCHED_FIFO | SCHED_RESET_ON_FORK, &param) == 0) {
+                return 0;
+        }
+
+        if (errno != EPERM) {
+                perror("sched_setscheduler");
+                return -1;
+        }
+
+        return rtkit_make_thread_realtime(tid, priority);
+}
+
+int rt_pin_thread(pid_t tid, int cpu) {
+        cpu_set_t set;
+
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        if (sched_setaffinity(tid, sizeof(set), &set) < 0) {
+                perror("sched_setaffinity");
+                return -1;
+        }
+
+        return 0;
+}
+
+// Only MCL_CURRENT: with MCL_FUTURE every later dmabuf/memfd mapping would
+// count against RLIMIT_MEMLOCK and start failing.
+int rt_lock_memory(void) {
+        if (mlockall(MCL_CURRENT) < 0) {
+                perror("mlockall");
+                return -1;
+        }
+
+        return 0;
+}
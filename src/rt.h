@@ -0,0 +1,14 @@
+#ifndef RT_H
+#define RT_H
+
+#include <sys/types.h>
+
+pid_t rt_gettid(void);
+
+// Try SCHED_FIFO directly first, then fall back to asking rtkit over D-Bus
+int rt_make_thread_realtime(pid_t tid, int priority);
+int rt_pin_thread(pid_t tid, int cpu);
+// Lock the pages already mapped so the hot path does not fault
+int rt_lock_memory(void);
+
+#endif
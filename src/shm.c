@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shm.h"
+
+// Readers retry a torn slot at most this often before reporting EAGAIN
+#define SHM_READ_RETRIES 16
+
+static long futex(_Atomic uint32_t *addr, int op, uint32_t val, const struct timespec *timeout) {
+        return syscall(SYS_futex, (uint32_t *)addr, op, val, timeout, NULL, 0);
+}
+
+static struct shm_ring *map_ring(int flags, int prot) {
+        int fd = shm_open(SHM_RING_NAME, flags, 0600);
+        if (fd < 0) {
+                return NULL;
+        }
+
+        if ((flags & O_CREAT) && ftruncate(fd, sizeof(struct shm_ring)) < 0) {
+                close(fd);
+                return NULL;
+        }
+
+        struct shm_ring *ring = mmap(NULL, sizeof(struct shm_ring), prot, MAP_SHARED, fd, 0);
+        close(fd);
+
+        return ring == MAP_FAILED ? NULL : ring;
+}
+
+struct shm_ring *shm_ring_create(void) {
+        struct shm_ring *ring = map_ring(O_CREAT | O_RDWR, PROT_READ | PROT_WRITE);
+        if (!ring) {
+                perror("shm_ring_create");
+                return NULL;
+        }
+
+        // Keep frame ids monotonic across writer restarts so readers that are
+        // still waiting on an old id wake up on the first new frame.
+        if (ring->magic != SHM_RING_MAGIC || ring->version != SHM_RING_VERSION) {
+                ring->magic = 0;
+                atomic_store(&ring->frame_id, 0);
+                atomic_store(&ring->notify, 0);
+                atomic_store(&ring->waiters, 0);
+                atomic_store(&ring->writer_pid, 0);
+                for (int i = 0; i < SHM_RING_SLOTS; i++) {
+                        atomic_store(&ring->slots[i].seq, 0);
+                }
+        }
+
+        ring->slot_count = SHM_RING_SLOTS;
+        ring->max_leds = SHM_RING_MAX_LEDS;
+        ring->version = SHM_RING_VERSION;
+        atomic_store(&ring->writer_pid, getpid());
+        atomic_thread_fence(memory_order_release);
+        ring->magic = SHM_RING_MAGIC;
+
+        return ring;
+}
+
+void shm_ring_publish(struct shm_ring *ring, const uint8_t *rgb, uint32_t led_count,
+                      uint32_t flags, uint64_t timestamp_ns) {
+        if (led_count > SHM_RING_MAX_LEDS)
+                led_count = SHM_RING_MAX_LEDS;
+
+        uint64_t id = atomic_load_explicit(&ring->frame_id, memory_order_relaxed) + 1;
+        struct shm_ring_slot *slot = &ring->slots[id % SHM_RING_SLOTS];
+
+        uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+        atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        slot->led_count = led_count;
+        slot->frame_id = id;
+        slot->timestamp_ns = timestamp_ns;
+        slot->flags = flags;
+        memcpy(slot->rgb, rgb, led_count * 3);
+
+        atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+        atomic_store_explicit(&ring->frame_id, id, memory_order_release);
+        atomic_store_explicit(&ring->notify, (uint32_t)id, memory_order_release);
+
+        // Pairs with the fence in shm_ring_wait(): either the reader sees the
+        // new frame id or this load sees the reader in `waiters`
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (atomic_load_explicit(&ring->waiters, memory_order_relaxed) > 0) {
+                futex(&ring->notify, FUTEX_WAKE, INT_MAX, NULL);
+        }
+}
+
+void shm_ring_destroy(struct shm_ring *ring) {
+        if (!ring)
+                return;
+
+        // Wake blocked readers so they notice the writer is gone
+        atomic_store(&ring->writer_pid, 0);
+        atomic_fetch_add(&ring->notify, 1);
+        futex(&ring->notify, FUTEX_WAKE, INT_MAX, NULL);
+
+        shm_unlink(SHM_RING_NAME);
+        munmap(ring, sizeof(struct shm_ring));
+}
+
+struct shm_ring *shm_ring_open(void) {
+        // Read-write so readers can register in `waiters`; frame data is never touched
+        struct shm_ring *ring = map_ring(O_RDWR, PROT_READ | PROT_WRITE);
+        if (!ring) {
+                return NULL;
+        }
+
+        if (ring->magic != SHM_RING_MAGIC || ring->version != SHM_RING_VERSION) {
+                munmap(ring, sizeof(struct shm_ring));
+                errno = EPROTO;
+                return NULL;
+        }
+
+        return ring;
+}
+
+int shm_ring_read(const struct shm_ring *ring, struct shm_ring_frame *frame) {
+        uint64_t id = atomic_load_explicit(&ring->frame_id, memory_order_acquire);
+        if (id == 0) {
+                errno = ENODATA;
+                return -1;
+        }
+
+        const struct shm_ring_slot *slot = &ring->slots[id % SHM_RING_SLOTS];
+
+        for (int attempt = 0; attempt < SHM_READ_RETRIES; attempt++) {
+                uint32_t before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+                if (before & 1)
+                        continue;
+
+                frame->frame_id = slot->frame_id;
+                frame->timestamp_ns = slot->timestamp_ns;
+                frame->flags = slot->flags;
+                frame->led_count = slot->led_count;
+                if (frame->led_count > SHM_RING_MAX_LEDS)
+                        frame->led_count = SHM_RING_MAX_LEDS;
+                memcpy(frame->rgb, slot->rgb, frame->led_count * 3);
+
+                atomic_thread_fence(memory_order_acquire);
+                uint32_t after = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+                if (before == after)
+                        return 0;
+        }
+
+        errno = EAGAIN;
+        return -1;
+}
+
+int shm_ring_wait(struct shm_ring *ring, uint64_t last_frame_id, int timeout_ms) {
+        struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        int ret = 0;
+
+        atomic_fetch_add(&ring->waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        // Re-check after registering so a frame published in between is not missed
+        if (atomic_load_explicit(&ring->frame_id, memory_order_acquire) == last_frame_id &&
+            atomic_load(&ring->writer_pid) != 0) {
+                if (futex(&ring->notify, FUTEX_WAIT, (uint32_t)last_frame_id,
+                          timeout_ms < 0 ? NULL : &ts) < 0 &&
+                    errno != EAGAIN && errno != EINTR) {
+                        ret = -1;
+                }
+        }
+
+        atomic_fetch_sub(&ring->waiters, 1);
+        return ret;
+}
+
+bool shm_ring_writer_alive(const struct shm_ring *ring) {
+        pid_t pid = atomic_load(&ring->writer_pid);
+
+        // EPERM: the pid exists but belongs to another user
+        return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+void shm_ring_close(struct shm_ring *ring) {
+        if (ring)
+                munmap(ring, sizeof(struct shm_ring));
+}
@@ -0,0 +1,71 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared-memory ring publishing every sampled frame to local readers.
+//
+// One writer (the capture thread), any number of readers. Each slot is a
+// seqlock: the writer makes `seq` odd, fills the slot, then makes it even
+// again; a reader copies the slot and retries if `seq` was odd or changed.
+// Readers that want to block wait on `notify` with FUTEX_WAIT; the writer
+// only issues FUTEX_WAKE when `waiters` is non-zero, so publishing a frame
+// costs no syscall while nobody is sleeping.
+//
+// `writer_pid` is set while a writer owns the ring and cleared when it shuts
+// down; the segment is unlinked at the same time. A crashed writer leaves its
+// pid behind, so readers should check shm_ring_writer_alive() rather than
+// trust the magic alone, and wait with a timeout.
+
+#define SHM_RING_NAME "/blight-frames"
+#define SHM_RING_MAGIC 0x31474c42 // "BLG1"
+#define SHM_RING_VERSION 2
+#define SHM_RING_SLOTS 8
+#define SHM_RING_MAX_LEDS 1024
+
+struct shm_ring_slot {
+        _Atomic uint32_t seq;
+        uint32_t led_count;
+        uint64_t frame_id;
+        uint64_t timestamp_ns; // CLOCK_MONOTONIC
+        uint32_t flags;
+        uint8_t rgb[SHM_RING_MAX_LEDS * 3];
+};
+
+struct shm_ring {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slot_count;
+        uint32_t max_leds;
+        _Atomic uint64_t frame_id; // newest complete frame, 0 = none yet
+        _Atomic uint32_t notify;   // low 32 bits of frame_id, futex word
+        _Atomic uint32_t waiters;
+        _Atomic int32_t writer_pid; // 0 once the writer has shut down
+        struct shm_ring_slot slots[SHM_RING_SLOTS];
+};
+
+struct shm_ring_frame {
+        uint64_t frame_id;
+        uint64_t timestamp_ns;
+        uint32_t flags;
+        uint32_t led_count;
+        uint8_t rgb[SHM_RING_MAX_LEDS * 3];
+};
+
+// Writer side
+struct shm_ring *shm_ring_create(void);
+void shm_ring_publish(struct shm_ring *ring, const uint8_t *rgb, uint32_t led_count,
+                      uint32_t flags, uint64_t timestamp_ns);
+void shm_ring_destroy(struct shm_ring *ring);
+
+// Reader side
+struct shm_ring *shm_ring_open(void);
+int shm_ring_read(const struct shm_ring *ring, struct shm_ring_frame *frame);
+int shm_ring_wait(struct shm_ring *ring, uint64_t last_frame_id, int timeout_ms);
+bool shm_ring_writer_alive(const struct shm_ring *ring);
+void shm_ring_close(struct shm_ring *ring);
+
+#endif
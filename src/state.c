@@ -0,0 +1,53 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "state.h"
+
+static char *restore_token_path(void) {
+        return g_build_filename(g_get_user_state_dir(), "blight", "restore_token", NULL);
+}
+
+char *state_load_restore_token(void) {
+        char *path = restore_token_path();
+        char *token = NULL;
+
+        if (!g_file_get_contents(path, &token, NULL, NULL)) {
+                g_free(path);
+                return NULL;
+        }
+        g_free(path);
+
+        g_strstrip(token);
+        if (token[0] == '\0') {
+                g_free(token);
+                return NULL;
+        }
+
+        return token;
+}
+
+int state_save_restore_token(const char *token) {
+        GError *error = NULL;
+        char *path = restore_token_path();
+        char *dir = g_path_get_dirname(path);
+
+        if (g_mkdir_with_parents(dir, 0700) < 0) {
+                g_printerr("Failed to create %s\n", dir);
+                g_free(dir);
+                g_free(path);
+                return -1;
+        }
+        g_free(dir);
+
+        // The token grants screen access without a prompt, keep it private
+        if (!g_file_set_contents_full(path, token, -1, G_FILE_SET_CONTENTS_CONSISTENT, 0600,
+                                      &error)) {
+                g_printerr("Failed to save restore token: %s\n", error->message);
+                g_error_free(error);
+                g_free(path);
+                return -1;
+        }
+
+        g_free(path);
+        return 0;
+}
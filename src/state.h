@@ -0,0 +1,11 @@
+#ifndef STATE_H
+#define STATE_H
+
+// Portal restore token kept in $XDG_STATE_HOME/blight/restore_token so later
+// runs can skip the screencast permission dialog.
+
+// Returns a newly allocated token (free with g_free) or NULL if none is stored
+char *state_load_restore_token(void);
+int state_save_restore_token(const char *token);
+
+#endif
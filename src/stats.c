@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+static int compare_u64(const void *a, const void *b) {
+        uint64_t x = *(const uint64_t *)a;
+        uint64_t y = *(const uint64_t *)b;
+        return (x > y) - (x < y);
+}
+
+void stats_reset(struct latency_stats *stats) { memset(stats, 0, sizeof(*stats)); }
+
+void stats_record(struct latency_stats *stats, uint64_t value_ns) {
+        stats->samples[stats->next] = value_ns;
+        stats->next = (stats->next + 1) % STATS_WINDOW;
+        if (stats->count < STATS_WINDOW)
+                stats->count++;
+}
+
+uint64_t stats_percentile(const struct latency_stats *stats, int percentile) {
+        uint64_t sorted[STATS_WINDOW];
+
+        if (stats->count == 0)
+                return 0;
+
+        if (percentile < 0)
+                percentile = 0;
+        if (percentile > 100)
+                percentile = 100;
+
+        memcpy(sorted, stats->samples, stats->count * sizeof(uint64_t));
+        qsort(sorted, stats->count, sizeof(uint64_t), compare_u64);
+
+        size_t index = (stats->count * percentile + 99) / 100;
+        if (index > 0)
+                index--;
+
+        return sorted[index];
+}
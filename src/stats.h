@@ -0,0 +1,23 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATS_WINDOW 256
+
+// Fixed window of latency samples in nanoseconds. Recording is O(1) and never
+// allocates, so it is safe to call from the capture thread.
+struct latency_stats {
+        uint64_t samples[STATS_WINDOW];
+        size_t count;
+        size_t next;
+};
+
+void stats_reset(struct latency_stats *stats);
+void stats_record(struct latency_stats *stats, uint64_t value_ns);
+
+// Returns the given percentile (0-100) of the current window, 0 if empty
+uint64_t stats_percentile(const struct latency_stats *stats, int percentile);
+
+#endif
@@ -1,14 +1,24 @@
 #include "wifi.h"
+#include "protocol.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 static int g_sockfd = -1;
 static struct sockaddr_in g_esp_addr;
 
+static size_t g_max_payload = PROTO_DEFAULT_PAYLOAD;
+static uint8_t g_encoding = PROTO_ENCODING_RGB888;
+static uint16_t g_frame_id = 0;
+static uint8_t g_chunk[PROTO_MAX_PAYLOAD];
+
 static int resolve_dns(const char *hostname, char *ip_out, size_t ip_len) {
         struct addrinfo hints, *result, *rp;
 
@@ -33,6 +43,72 @@ static int resolve_dns(const char *hostname, char *ip_out, size_t ip_len) {
         return -1;
 }
 
+// The connected socket reports ICMP errors (receiver offline, no route) on
+// every send. Print them at most once per interval instead of once per frame.
+#define SEND_ERROR_INTERVAL_NS 5000000000ULL
+
+static void report_send_error(const char *what) {
+        static uint64_t last_ns = 0;
+        static unsigned int suppressed = 0;
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+        if (last_ns && now - last_ns < SEND_ERROR_INTERVAL_NS) {
+                suppressed++;
+                return;
+        }
+
+        if (suppressed > 0) {
+                fprintf(stderr, "%s: %s (%u similar errors suppressed)\n", what,
+                        strerror(errno), suppressed);
+        } else {
+                fprintf(stderr, "%s: %s\n", what, strerror(errno));
+        }
+
+        last_ns = now;
+        suppressed = 0;
+}
+
+// Connect the socket so the kernel tracks the path MTU to the ESP32, and
+// forbid fragmentation so an oversized chunk fails with EMSGSIZE instead
+// of silently turning into fragments.
+static void update_path_mtu(void) {
+        int pmtu = IP_PMTUDISC_DO;
+        int mtu = 0;
+        socklen_t len = sizeof(mtu);
+
+        g_max_payload = PROTO_DEFAULT_PAYLOAD;
+
+        if (connect(g_sockfd, (struct sockaddr *)&g_esp_addr, sizeof(g_esp_addr)) < 0) {
+                perror("connect");
+                return;
+        }
+
+        if (setsockopt(g_sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtu, sizeof(pmtu)) < 0) {
+                perror("setsockopt IP_MTU_DISCOVER");
+                return;
+        }
+
+        if (getsockopt(g_sockfd, IPPROTO_IP, IP_MTU, &mtu, &len) < 0) {
+                perror("getsockopt IP_MTU");
+                return;
+        }
+
+        // IPv4 header + UDP header
+        if (mtu > 28 + PROTO_FRAME_HEADER_SIZE) {
+                g_max_payload = mtu - 28;
+                // Never more than the receiver accepts, whatever the route allows
+                if (g_max_payload > PROTO_MAX_PAYLOAD)
+                        g_max_payload = PROTO_MAX_PAYLOAD;
+        }
+
+#ifdef DEBUG
+        printf("Path MTU %d, max UDP payload %zu\n", mtu, g_max_payload);
+#endif
+}
+
 int wifi_init(const char *esp_hostname, uint16_t port, int timeout_ms) {
         char esp_ip[INET_ADDRSTRLEN];
 
@@ -59,6 +135,33 @@ int wifi_init(const char *esp_hostname, uint16_t port, int timeout_ms) {
         g_esp_addr.sin_port = htons(port);
         inet_pton(AF_INET, esp_ip, &g_esp_addr.sin_addr);
 
+        update_path_mtu();
+
+        return 0;
+}
+
+// DSCP EF (46). mac80211 maps it to user priority 6, i.e. the WMM AC_VO queue.
+#define WIFI_TOS_VOICE 0xB8
+// Highest SO_PRIORITY an unprivileged socket may set (TC_PRIO_INTERACTIVE)
+#define WIFI_SO_PRIORITY 6
+
+int wifi_set_low_latency(void) {
+        if (g_sockfd < 0) {
+                return -1;
+        }
+
+        int tos = WIFI_TOS_VOICE;
+        if (setsockopt(g_sockfd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0) {
+                perror("setsockopt IP_TOS");
+                return -1;
+        }
+
+        int prio = WIFI_SO_PRIORITY;
+        if (setsockopt(g_sockfd, SOL_SOCKET, SO_PRIORITY, &prio, sizeof(prio)) < 0) {
+                perror("setsockopt SO_PRIORITY");
+                return -1;
+        }
+
         return 0;
 }
 
@@ -71,13 +174,94 @@ ssize_t wifi_tx(const uint8_t *data, size_t len) {
             sendto(g_sockfd, data, len, 0, (struct sockaddr *)&g_esp_addr, sizeof(g_esp_addr));
 
         if (sent < 0) {
-                perror("sendto");
+                report_send_error("sendto");
                 return -1;
         }
 
         return sent;
 }
 
+void wifi_set_encoding(uint8_t encoding) { g_encoding = encoding; }
+
+static void put_u16(uint8_t *dst, uint16_t value) {
+        dst[0] = value & 0xFF;
+        dst[1] = value >> 8;
+}
+
+static size_t encode_leds(uint8_t *dst, const uint8_t *rgb, uint16_t count) {
+        if (g_encoding == PROTO_ENCODING_RGB565) {
+                for (uint16_t i = 0; i < count; i++) {
+                        const uint8_t *px = rgb + i * 3;
+                        uint16_t packed = ((px[0] & 0xF8) << 8) | ((px[1] & 0xFC) << 3) | (px[2] >> 3);
+                        put_u16(dst + i * 2, packed);
+                }
+                return count * 2;
+        }
+
+        memcpy(dst, rgb, count * 3);
+        return count * 3;
+}
+
+// Re-read the kernel's path MTU after EMSGSIZE. Returns 0 if it shrank.
+static int shrink_payload_to_path_mtu(void) {
+        int mtu = 0;
+        socklen_t len = sizeof(mtu);
+
+        if (getsockopt(g_sockfd, IPPROTO_IP, IP_MTU, &mtu, &len) < 0 ||
+            mtu <= 28 + PROTO_FRAME_HEADER_SIZE + 3 || (size_t)(mtu - 28) >= g_max_payload) {
+                return -1;
+        }
+
+        g_max_payload = mtu - 28;
+        return 0;
+}
+
+ssize_t wifi_tx_frame(const uint8_t *rgb, uint16_t led_count, uint8_t flags) {
+        if (g_sockfd < 0 || led_count == 0) {
+                return -1;
+        }
+
+        size_t bytes_per_led = g_encoding == PROTO_ENCODING_RGB565 ? 2 : 3;
+        size_t max_leds = (g_max_payload - PROTO_FRAME_HEADER_SIZE) / bytes_per_led;
+        size_t chunks = (led_count + max_leds - 1) / max_leds;
+        // Spread LEDs evenly instead of sending full chunks and a runt
+        size_t per_chunk = (led_count + chunks - 1) / chunks;
+        uint16_t frame_id = g_frame_id++;
+        ssize_t total_sent = 0;
+
+        for (size_t offset = 0; offset < led_count; offset += per_chunk) {
+                size_t count = led_count - offset;
+                if (count > per_chunk)
+                        count = per_chunk;
+
+                g_chunk[0] = PROTO_MAGIC;
+                g_chunk[1] = PROTO_FRAME;
+                g_chunk[2] = flags;
+                g_chunk[3] = g_encoding;
+                put_u16(g_chunk + 4, frame_id);
+                put_u16(g_chunk + 6, offset);
+                put_u16(g_chunk + 8, count);
+                put_u16(g_chunk + 10, led_count);
+
+                size_t len = PROTO_FRAME_HEADER_SIZE +
+                             encode_leds(g_chunk + PROTO_FRAME_HEADER_SIZE, rgb + offset * 3, count);
+
+                ssize_t sent = send(g_sockfd, g_chunk, len, 0);
+                if (sent < 0) {
+                        // The path MTU shrank: drop this frame, the next one is re-split
+                        if (errno == EMSGSIZE && shrink_payload_to_path_mtu() == 0) {
+                                return total_sent;
+                        }
+                        report_send_error("send");
+                        return -1;
+                }
+
+                total_sent += sent;
+        }
+
+        return total_sent;
+}
+
 void wifi_close(void) {
         if (g_sockfd >= 0) {
                 close(g_sockfd);
@@ -5,7 +5,10 @@
 #include <sys/types.h>
 
 int wifi_init(const char *esp_hostname, uint16_t port, int timeout_ms);
+int wifi_set_low_latency(void);
+void wifi_set_encoding(uint8_t encoding);
 ssize_t wifi_tx(const uint8_t *data, size_t len);
+ssize_t wifi_tx_frame(const uint8_t *rgb, uint16_t led_count, uint8_t flags);
 void wifi_close(void);
 
 #endif
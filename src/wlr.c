@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+
+#include "wlr-screencopy-unstable-v1-client-protocol.h"
+#include "xdg-output-unstable-v1-client-protocol.h"
+#include "wlr.h"
+
+enum { STRIP_LEFT, STRIP_TOP, STRIP_RIGHT, STRIP_COUNT };
+
+struct strip {
+        // Requested region in physical output pixels
+        int x, y, width, height;
+        // The same region in logical coordinates, as the protocol wants it
+        int logical_x, logical_y, logical_width, logical_height;
+
+        struct zwlr_screencopy_frame_v1 *frame;
+        struct wl_buffer *buffer;
+        uint8_t *data;
+        size_t size;
+
+        uint32_t format;
+        uint32_t buf_width;
+        uint32_t buf_height;
+        uint32_t stride;
+        bool y_invert;
+        bool done;
+        bool failed;
+};
+
+static struct {
+        struct wl_display *display;
+        struct wl_registry *registry;
+        struct wl_shm *shm;
+        struct zwlr_screencopy_manager_v1 *manager;
+        uint32_t manager_version;
+        struct wl_output *output;
+        struct zxdg_output_manager_v1 *xdg_output_manager;
+        struct zxdg_output_v1 *xdg_output;
+
+        int32_t mode_width;
+        int32_t mode_height;
+        int32_t scale;
+        int32_t transform;
+        // From xdg-output, 0 if the compositor does not offer it
+        int32_t logical_width;
+        int32_t logical_height;
+
+        uint32_t width;
+        uint32_t height;
+        // Physical pixels per logical unit, fractional under fractional scaling
+        double scale_x;
+        double scale_y;
+        struct strip strips[STRIP_COUNT];
+        int pending;
+} g_wlr = {.scale = 1};
+
+static uint64_t get_time_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void output_geometry(void *data, struct wl_output *output, int32_t x, int32_t y,
+                            int32_t phys_w, int32_t phys_h, int32_t subpixel, const char *make,
+                            const char *model, int32_t transform) {
+        g_wlr.transform = transform;
+}
+
+static void output_mode(void *data, struct wl_output *output, uint32_t flags, int32_t width,
+                        int32_t height, int32_t refresh) {
+        if (flags & WL_OUTPUT_MODE_CURRENT) {
+                g_wlr.mode_width = width;
+                g_wlr.mode_height = height;
+        }
+}
+
+static void output_done(void *data, struct wl_output *output) {}
+
+static void output_scale(void *data, struct wl_output *output, int32_t factor) {
+        g_wlr.scale = factor > 0 ? factor : 1;
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_geometry,
+    .mode = output_mode,
+    .done = output_done,
+    .scale = output_scale,
+};
+
+static void xdg_output_logical_position(void *data, struct zxdg_output_v1 *xdg_output,
+                                       int32_t x, int32_t y) {}
+
+static void xdg_output_logical_size(void *data, struct zxdg_output_v1 *xdg_output,
+                                   int32_t width, int32_t height) {
+        g_wlr.logical_width = width;
+        g_wlr.logical_height = height;
+}
+
+static void xdg_output_done(void *data, struct zxdg_output_v1 *xdg_output) {}
+
+static void xdg_output_name(void *data, struct zxdg_output_v1 *xdg_output, const char *name) {}
+
+static void xdg_output_description(void *data, struct zxdg_output_v1 *xdg_output,
+                                   const char *description) {}
+
+static const struct zxdg_output_v1_listener xdg_output_listener = {
+    .logical_position = xdg_output_logical_position,
+    .logical_size = xdg_output_logical_size,
+    .done = xdg_output_done,
+    .name = xdg_output_name,
+    .description = xdg_output_description,
+};
+
+static void registry_global(void *data, struct wl_registry *registry, uint32_t name,
+                            const char *interface, uint32_t version) {
+        if (strcmp(interface, wl_shm_interface.name) == 0) {
+                g_wlr.shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+        } else if (strcmp(interface, zwlr_screencopy_manager_v1_interface.name) == 0) {
+                g_wlr.manager_version = version < 3 ? version : 3;
+                g_wlr.manager = wl_registry_bind(registry, name,
+                                                 &zwlr_screencopy_manager_v1_interface,
+                                                 g_wlr.manager_version);
+        } else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
+                g_wlr.xdg_output_manager =
+                    wl_registry_bind(registry, name, &zxdg_output_manager_v1_interface,
+                                     version < 3 ? version : 3);
+        } else if (strcmp(interface, wl_output_interface.name) == 0 && g_wlr.output == NULL) {
+                g_wlr.output = wl_registry_bind(registry, name, &wl_output_interface, 2);
+                wl_output_add_listener(g_wlr.output, &output_listener, NULL);
+        }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name) {}
+
+static const struct wl_registry_listener registry_listener = {
+    .global = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+static bool is_supported_format(uint32_t format) {
+        return format == WL_SHM_FORMAT_XRGB8888 || format == WL_SHM_FORMAT_ARGB8888 ||
+               format == WL_SHM_FORMAT_XBGR8888 || format == WL_SHM_FORMAT_ABGR8888;
+}
+
+static void destroy_strip_buffer(struct strip *strip) {
+        if (strip->buffer) {
+                wl_buffer_destroy(strip->buffer);
+                strip->buffer = NULL;
+        }
+        if (strip->data) {
+                munmap(strip->data, strip->size);
+                strip->data = NULL;
+        }
+}
+
+static int create_strip_buffer(struct strip *strip, uint32_t format, uint32_t width,
+                               uint32_t height, uint32_t stride) {
+        size_t size = (size_t)stride * height;
+
+        int fd = memfd_create("blight-strip", MFD_CLOEXEC);
+        if (fd < 0) {
+                perror("memfd_create");
+                return -1;
+        }
+
+        if (ftruncate(fd, size) < 0) {
+                perror("ftruncate");
+                close(fd);
+                return -1;
+        }
+
+        uint8_t *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+                perror("mmap");
+                close(fd);
+                return -1;
+        }
+
+        struct wl_shm_pool *pool = wl_shm_create_pool(g_wlr.shm, fd, size);
+        strip->buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, format);
+        wl_shm_pool_destroy(pool);
+        close(fd);
+
+        strip->data = data;
+        strip->size = size;
+        strip->format = format;
+        strip->buf_width = width;
+        strip->buf_height = height;
+        strip->stride = stride;
+
+        return 0;
+}
+
+static void finish_strip(struct strip *strip, bool failed) {
+        if (strip->done)
+                return;
+
+        strip->done = true;
+        strip->failed = failed;
+        g_wlr.pending--;
+}
+
+static void frame_buffer(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t format,
+                         uint32_t width, uint32_t height, uint32_t stride) {
+        struct strip *strip = data;
+
+        if (!is_supported_format(format)) {
+                // Version 3 may still offer another buffer type before buffer_done
+                if (g_wlr.manager_version < 3) {
+                        finish_strip(strip, true);
+                }
+                return;
+        }
+
+        // Buffers are reused across frames and only reallocated on a mode change
+        if (!strip->buffer || strip->format != format || strip->buf_width != width ||
+            strip->buf_height != height || strip->stride != stride) {
+                destroy_strip_buffer(strip);
+                if (create_strip_buffer(strip, format, width, height, stride) < 0) {
+                        finish_strip(strip, true);
+                        return;
+                }
+        }
+
+        // Before version 3 there is no buffer_done, wl_shm is the only option
+        if (g_wlr.manager_version < 3) {
+                zwlr_screencopy_frame_v1_copy(frame, strip->buffer);
+        }
+}
+
+static void frame_flags(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t flags) {
+        struct strip *strip = data;
+        strip->y_invert = flags & ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT;
+}
+
+static void frame_ready(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t tv_sec_hi,
+                        uint32_t tv_sec_lo, uint32_t tv_nsec) {
+        finish_strip(data, false);
+}
+
+static void frame_failed(void *data, struct zwlr_screencopy_frame_v1 *frame) {
+        finish_strip(data, true);
+}
+
+static void frame_damage(void *data, struct zwlr_screencopy_frame_v1 *frame, uint32_t x,
+                         uint32_t y, uint32_t width, uint32_t height) {}
+
+static void frame_linux_dmabuf(void *data, struct zwlr_screencopy_frame_v1 *frame,
+                               uint32_t format, uint32_t width, uint32_t height) {}
+
+static void frame_buffer_done(void *data, struct zwlr_screencopy_frame_v1 *frame) {
+        struct strip *strip = data;
+
+        if (!strip->buffer || !is_supported_format(strip->format)) {
+                finish_strip(strip, true);
+                return;
+        }
+
+        zwlr_screencopy_frame_v1_copy(frame, strip->buffer);
+}
+
+static const struct zwlr_screencopy_frame_v1_listener frame_listener = {
+    .buffer = frame_buffer,
+    .flags = frame_flags,
+    .ready = frame_ready,
+    .failed = frame_failed,
+    .damage = frame_damage,
+    .linux_dmabuf = frame_linux_dmabuf,
+    .buffer_done = frame_buffer_done,
+};
+
+// Guards the rounding below against float error at exact logical edges
+#define LOGICAL_EPSILON 1e-6
+
+static void set_strip_region(struct strip *strip, int x, int y, int width, int height) {
+        strip->x = x;
+        strip->y = y;
+        strip->width = width;
+        strip->height = height;
+
+        // Round outwards so the logical region always covers the physical one
+        strip->logical_x = (int)floor(x / g_wlr.scale_x + LOGICAL_EPSILON);
+        strip->logical_y = (int)floor(y / g_wlr.scale_y + LOGICAL_EPSILON);
+        strip->logical_width =
+            (int)ceil((x + width) / g_wlr.scale_x - LOGICAL_EPSILON) - strip->logical_x;
+        strip->logical_height =
+            (int)ceil((y + height) / g_wlr.scale_y - LOGICAL_EPSILON) - strip->logical_y;
+}
+
+static void update_geometry(void) {
+        uint32_t width = g_wlr.mode_width;
+        uint32_t height = g_wlr.mode_height;
+
+        if (width == 0 || height == 0)
+                return;
+
+        // wl_output.scale is an integer rounded up under fractional scaling
+        // (1.5 is reported as 2), only xdg-output knows the real logical size
+        double scale_x = g_wlr.scale;
+        double scale_y = g_wlr.scale;
+        if (g_wlr.logical_width > 0 && g_wlr.logical_height > 0) {
+                scale_x = (double)width / g_wlr.logical_width;
+                scale_y = (double)height / g_wlr.logical_height;
+        }
+
+        if (width == g_wlr.width && height == g_wlr.height && scale_x == g_wlr.scale_x &&
+            scale_y == g_wlr.scale_y)
+                return;
+
+        g_wlr.width = width;
+        g_wlr.height = height;
+        g_wlr.scale_x = scale_x;
+        g_wlr.scale_y = scale_y;
+
+        int box_w = (CAPTURE_DEPTH * width) / CAPTURE_WIDTH;
+        int box_h = (CAPTURE_DEPTH * height) / CAPTURE_HEIGHT;
+        int right_x = ((CAPTURE_WIDTH - CAPTURE_DEPTH) * width) / CAPTURE_WIDTH;
+        if (box_w < 1)
+                box_w = 1;
+        if (box_h < 1)
+                box_h = 1;
+
+        set_strip_region(&g_wlr.strips[STRIP_LEFT], 0, 0, box_w, height);
+        set_strip_region(&g_wlr.strips[STRIP_TOP], 0, 0, width, box_h);
+        set_strip_region(&g_wlr.strips[STRIP_RIGHT], right_x, 0, width - right_x, height);
+
+#ifdef DEBUG
+        printf("wlr-screencopy: %ux%u output at scale %.3f, capturing %dpx side and %dpx top "
+               "strips\n",
+               width, height, scale_x, box_w, box_h);
+#endif
+}
+
+static void flip_rows(struct strip *strip) {
+        uint8_t row[strip->stride];
+
+        for (uint32_t top = 0, bottom = strip->buf_height - 1; top < bottom; top++, bottom--) {
+                memcpy(row, strip->data + top * strip->stride, strip->stride);
+                memcpy(strip->data + top * strip->stride, strip->data + bottom * strip->stride,
+                       strip->stride);
+                memcpy(strip->data + bottom * strip->stride, row, strip->stride);
+        }
+}
+
+static int capture_round(void) {
+        for (int i = 0; i < STRIP_COUNT; i++) {
+                struct strip *strip = &g_wlr.strips[i];
+
+                strip->done = false;
+                strip->failed = false;
+                strip->y_invert = false;
+                strip->frame = zwlr_screencopy_manager_v1_capture_output_region(
+                    g_wlr.manager, 0, g_wlr.output, strip->logical_x, strip->logical_y,
+                    strip->logical_width, strip->logical_height);
+                zwlr_screencopy_frame_v1_add_listener(strip->frame, &frame_listener, strip);
+                g_wlr.pending++;
+        }
+
+        int ret = 0;
+        while (g_wlr.pending > 0) {
+                if (wl_display_dispatch(g_wlr.display) < 0) {
+                        perror("wl_display_dispatch");
+                        return -1;
+                }
+        }
+
+        for (int i = 0; i < STRIP_COUNT; i++) {
+                struct strip *strip = &g_wlr.strips[i];
+
+                zwlr_screencopy_frame_v1_destroy(strip->frame);
+                strip->frame = NULL;
+
+                if (strip->failed) {
+                        ret = 1;
+                } else if (strip->y_invert) {
+                        flip_rows(strip);
+                }
+        }
+
+        return ret;
+}
+
+// The compositor captured from the logical origin, which may sit a few
+// physical pixels before the requested one at scale > 1
+static struct edge_source strip_source(const struct strip *strip) {
+        struct edge_source source = {strip->data, strip->size, strip->stride,
+                                     (int)lround(strip->logical_x * g_wlr.scale_x),
+                                     (int)lround(strip->logical_y * g_wlr.scale_y)};
+        return source;
+}
+
+static void cleanup(void) {
+        for (int i = 0; i < STRIP_COUNT; i++) {
+                destroy_strip_buffer(&g_wlr.strips[i]);
+        }
+        if (g_wlr.manager)
+                zwlr_screencopy_manager_v1_destroy(g_wlr.manager);
+        if (g_wlr.xdg_output)
+                zxdg_output_v1_destroy(g_wlr.xdg_output);
+        if (g_wlr.xdg_output_manager)
+                zxdg_output_manager_v1_destroy(g_wlr.xdg_output_manager);
+        if (g_wlr.output)
+                wl_output_destroy(g_wlr.output);
+        if (g_wlr.shm)
+                wl_shm_destroy(g_wlr.shm);
+        if (g_wlr.registry)
+                wl_registry_destroy(g_wlr.registry);
+        wl_display_disconnect(g_wlr.display);
+}
+
+// Region captures come back in the output's untransformed buffer orientation,
+// so on a rotated or flipped output the strips would not be where sample_edges()
+// looks for them. Only untransformed outputs are supported for now.
+static bool transform_supported(void) {
+        if (g_wlr.transform == WL_OUTPUT_TRANSFORM_NORMAL)
+                return true;
+
+        fprintf(stderr,
+                "wlr-screencopy: output transform %d is not supported, rotated and flipped "
+                "outputs need the portal capture (run without -w)\n",
+                g_wlr.transform);
+        return false;
+}
+
+static volatile sig_atomic_t g_stop = 0;
+
+void wlr_capture_stop(void) { g_stop = 1; }
+
+int wlr_capture_run(capture_frame_fn on_frame) {
+        g_wlr.display = wl_display_connect(NULL);
+        if (!g_wlr.display) {
+                fprintf(stderr, "Failed to connect to the Wayland display\n");
+                return -1;
+        }
+
+        g_wlr.registry = wl_display_get_registry(g_wlr.display);
+        wl_registry_add_listener(g_wlr.registry, &registry_listener, NULL);
+
+        // First roundtrip binds the globals, the second collects output modes
+        // and the logical size
+        wl_display_roundtrip(g_wlr.display);
+        if (g_wlr.xdg_output_manager && g_wlr.output) {
+                g_wlr.xdg_output =
+                    zxdg_output_manager_v1_get_xdg_output(g_wlr.xdg_output_manager, g_wlr.output);
+                zxdg_output_v1_add_listener(g_wlr.xdg_output, &xdg_output_listener, NULL);
+        }
+        wl_display_roundtrip(g_wlr.display);
+
+        if (!g_wlr.manager || !g_wlr.shm || !g_wlr.output) {
+                fprintf(stderr, "Compositor does not support wlr-screencopy region capture\n");
+                cleanup();
+                return -1;
+        }
+
+        if (!transform_supported()) {
+                cleanup();
+                return -1;
+        }
+
+        uint64_t period = 1000000000ULL / CAPTURE_FRAMES;
+        uint64_t next = get_time_ns();
+
+        while (!g_stop) {
+                uint64_t now = get_time_ns();
+
+                // The output can be rotated while running
+                if (!transform_supported()) {
+                        break;
+                }
+
+                update_geometry();
+
+                int ret = capture_round();
+                if (ret < 0) {
+                        break;
+                }
+
+                if (ret == 0) {
+                        struct strip *s = g_wlr.strips;
+                        struct edge_source left = strip_source(&s[STRIP_LEFT]);
+                        struct edge_source top = strip_source(&s[STRIP_TOP]);
+                        struct edge_source right = strip_source(&s[STRIP_RIGHT]);
+                        // XRGB/ARGB8888 are little-endian words, i.e. B, G, R, X in memory
+                        bool is_bgr = s[STRIP_LEFT].format == WL_SHM_FORMAT_XRGB8888 ||
+                                      s[STRIP_LEFT].format == WL_SHM_FORMAT_ARGB8888;
+
+                        on_frame(&left, &top, &right, g_wlr.width, g_wlr.height, is_bgr, now);
+                }
+#ifdef DEBUG
+                else {
+                        printf("\r[FRAME] wlr-screencopy capture failed\n");
+                }
+#endif
+
+                next += period;
+                if (next < get_time_ns()) {
+                        next = get_time_ns();
+                        continue;
+                }
+
+                struct timespec ts = {next / 1000000000ULL, next % 1000000000ULL};
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR &&
+                       !g_stop)
+                        ;
+        }
+
+        cleanup();
+        return g_stop ? 0 : -1;
+}
@@ -0,0 +1,18 @@
+#ifndef WLR_H
+#define WLR_H
+
+#include "capture.h"
+
+// Capture backend for wlroots compositors (Sway, Hyprland, ...). Instead of a
+// full-frame portal stream it asks wlr-screencopy for just the left, top and
+// right border strips of the first output, copies them into small shm buffers
+// and hands them to on_frame at CAPTURE_FRAMES. Blocks until the Wayland
+// connection fails or wlr_capture_stop() is called; returns -1 if the
+// compositor lacks the protocol, the output is rotated or flipped, or the
+// connection broke.
+int wlr_capture_run(capture_frame_fn on_frame);
+
+// Async-signal-safe, makes wlr_capture_run() return 0 after the current frame
+void wlr_capture_stop(void);
+
+#endif
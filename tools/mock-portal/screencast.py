@@ -0,0 +1,200 @@
+"""python-dbusmock template for org.freedesktop.portal.ScreenCast.
+
+Just enough of the portal for libportal's screencast flow: CreateSession,
+SelectSources, Start and OpenPipeWireRemote, each answered through a
+Request object like xdg-desktop-portal does. Used by test-restore.sh to
+exercise blight's restore token handling on a private session bus.
+
+Restore tokens behave like the real portal: every successful Start with
+persist_mode set hands out a new token and consumes the one it was given.
+A token the mock never issued (or already consumed) is ignored and the
+"dialog" is shown instead, as xdg-desktop-portal does; the real portal never
+fails Start over a token.
+
+Parameters (-p JSON):
+  log                   file to append one line per portal decision to
+  node                  PipeWire node id reported in the stream list
+  pipewire_socket       socket OpenPipeWireRemote connects to; /dev/null is
+                        handed out when it cannot be reached
+  dialog_delay_ms       time the simulated screen picker stays open
+
+Behaviour is switched at runtime through org.freedesktop.DBus.Properties.Set
+on the org.blight.MockPortal interface:
+  FailStart             Start fails with response 2, like a backend error
+  CancelDialog          the simulated picker is cancelled by the user
+"""
+
+import os
+import socket
+
+import dbus
+import dbus.service
+from dbusmock import mockobject
+from gi.repository import GLib
+
+BUS_NAME = "org.freedesktop.portal.Desktop"
+MAIN_OBJ = "/org/freedesktop/portal/desktop"
+MAIN_IFACE = "org.freedesktop.portal.ScreenCast"
+SYSTEM_BUS = False
+
+REQUEST_IFACE = "org.freedesktop.portal.Request"
+SESSION_IFACE = "org.freedesktop.portal.Session"
+CONTROL_IFACE = "org.blight.MockPortal"
+
+RESPONSE_SUCCESS = 0
+RESPONSE_CANCELLED = 1
+RESPONSE_OTHER = 2
+
+# Delay before the Response signal so it never overtakes the method reply
+RESPONSE_DELAY_MS = 10
+
+params = {}
+sessions = {}
+issued_tokens = set()
+token_serial = 0
+
+
+def load(mock, parameters):
+    params.update(parameters or {})
+
+    mock.AddProperties(
+        MAIN_IFACE,
+        dbus.Dictionary(
+            {
+                "version": dbus.UInt32(4),
+                "AvailableSourceTypes": dbus.UInt32(7),
+                "AvailableCursorModes": dbus.UInt32(7),
+            },
+            signature="sv",
+        ),
+    )
+    mock.AddProperties(
+        CONTROL_IFACE,
+        dbus.Dictionary(
+            {"FailStart": dbus.Boolean(False), "CancelDialog": dbus.Boolean(False)},
+            signature="sv",
+        ),
+    )
+
+
+def log(message):
+    path = params.get("log")
+    if path:
+        with open(path, "a") as f:
+            f.write(message + "\n")
+
+
+def sender_path(sender):
+    return sender.lstrip(":").replace(".", "_")
+
+
+def respond(mock, sender, options, response, results=None):
+    token = options.get("handle_token", "t%d" % id(options))
+    path = "%s/request/%s/%s" % (MAIN_OBJ, sender_path(sender), token)
+    mock.AddObject(path, REQUEST_IFACE, {}, [("Close", "", "", "")])
+
+    def emit():
+        request = mockobject.objects[path]
+        request.EmitSignal(
+            REQUEST_IFACE,
+            "Response",
+            "ua{sv}",
+            [dbus.UInt32(response), dbus.Dictionary(results or {}, signature="sv")],
+        )
+        mock.RemoveObject(path)
+        return False
+
+    GLib.timeout_add(RESPONSE_DELAY_MS, emit)
+    return dbus.ObjectPath(path)
+
+
+def new_token():
+    global token_serial
+    token_serial += 1
+    token = "blight-mock-token-%d" % token_serial
+    issued_tokens.add(token)
+    return token
+
+
+@dbus.service.method(MAIN_IFACE, in_signature="a{sv}", out_signature="o", sender_keyword="sender")
+def CreateSession(self, options, sender):
+    path = "%s/session/%s/%s" % (
+        MAIN_OBJ,
+        sender_path(sender),
+        options.get("session_handle_token", "s%d" % len(sessions)),
+    )
+    self.AddObject(path, SESSION_IFACE, {}, [("Close", "", "", "")])
+    sessions[path] = {}
+    log("create-session")
+    return respond(self, sender, options, RESPONSE_SUCCESS, {"session_handle": dbus.String(path)})
+
+
+@dbus.service.method(MAIN_IFACE, in_signature="oa{sv}", out_signature="o", sender_keyword="sender")
+def SelectSources(self, session_handle, options, sender):
+    sessions[str(session_handle)] = dict(options)
+    return respond(self, sender, options, RESPONSE_SUCCESS)
+
+
+@dbus.service.method(MAIN_IFACE, in_signature="osa{sv}", out_signature="o", sender_keyword="sender")
+def Start(self, session_handle, parent_window, options, sender):
+    selected = sessions.get(str(session_handle), {})
+    token = str(selected.get("restore_token", ""))
+    persist = int(selected.get("persist_mode", 0))
+    streams = dbus.Array(
+        [(dbus.UInt32(params.get("node", 0)), dbus.Dictionary({}, signature="sv"))],
+        signature="(ua{sv})",
+    )
+
+    def results():
+        r = {"streams": streams}
+        if persist:
+            r["restore_token"] = dbus.String(new_token())
+        return r
+
+    if self.Get(CONTROL_IFACE, "FailStart"):
+        log("start-failed")
+        return respond(self, sender, options, RESPONSE_OTHER)
+
+    if token and token in issued_tokens:
+        issued_tokens.discard(token)
+        log("token-accepted %s" % token)
+        return respond(self, sender, options, RESPONSE_SUCCESS, results())
+
+    if token:
+        log("token-unknown %s" % token)
+
+    log("dialog-shown")
+    path = "%s/request/%s/%s" % (MAIN_OBJ, sender_path(sender), options.get("handle_token"))
+
+    # The picker is interactive, answer after it has been "open" for a while
+    def close_dialog():
+        if self.Get(CONTROL_IFACE, "CancelDialog"):
+            log("dialog-cancelled")
+            respond(self, sender, options, RESPONSE_CANCELLED)
+        else:
+            respond(self, sender, options, RESPONSE_SUCCESS, results())
+        return False
+
+    GLib.timeout_add(int(params.get("dialog_delay_ms", 50)), close_dialog)
+    return dbus.ObjectPath(path)
+
+
+@dbus.service.method(MAIN_IFACE, in_signature="oa{sv}", out_signature="h")
+def OpenPipeWireRemote(self, session_handle, options):
+    path = params.get("pipewire_socket") or os.path.join(
+        os.environ.get("XDG_RUNTIME_DIR", "/run/user/%d" % os.getuid()), "pipewire-0"
+    )
+
+    try:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.connect(path)
+        fd = os.dup(sock.fileno())
+        sock.close()
+    except OSError:
+        fd = os.open("/dev/null", os.O_RDWR)
+
+    # UnixFd keeps its own duplicate
+    handle = dbus.types.UnixFd(fd)
+    os.close(fd)
+    log("open-pipewire-remote")
+    return handle
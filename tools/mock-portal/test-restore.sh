@@ -0,0 +1,120 @@
+#!/bin/sh
+# Exercises blight's restore token handling against the mock ScreenCast portal
+# in screencast.py, on a private session bus with a scratch XDG_STATE_HOME.
+#
+# Usage: tools/mock-portal/test-restore.sh [path/to/blight]
+#
+# Needs python-dbusmock. Frames are sent to 127.0.0.1, where blight-emu is
+# started if it has been built. Set BLIGHT_TEST_NODE to the id of a running
+# PipeWire video node (e.g. gst-launch-1.0 videotestsrc ! pipewiresink) to
+# also check the time to the first LED frame; otherwise that case is skipped.
+
+set -eu
+
+here=$(cd "$(dirname "$0")" && pwd)
+blight=$(realpath "${1:-./blight}")
+emu=$(dirname "$blight")/blight-emu
+run_seconds=${RUN_SECONDS:-4}
+
+if [ -z "${BLIGHT_PRIVATE_BUS:-}" ]; then
+        exec env BLIGHT_PRIVATE_BUS=1 dbus-run-session -- "$0" "$@"
+fi
+
+scratch=$(mktemp -d)
+log=$scratch/portal.log
+out=$scratch/blight.log
+token_file=$scratch/state/blight/restore_token
+export XDG_STATE_HOME=$scratch/state
+
+cleanup() {
+        kill $(jobs -p) 2>/dev/null || true
+        rm -rf "$scratch"
+}
+trap cleanup EXIT
+
+python3 -m dbusmock --session --template "$here/screencast.py" \
+        -p "{\"log\": \"$log\", \"node\": ${BLIGHT_TEST_NODE:-0}}" >/dev/null 2>&1 &
+
+for _ in $(seq 50); do
+        gdbus introspect --session --dest org.freedesktop.portal.Desktop \
+                --object-path /org/freedesktop/portal/desktop >/dev/null 2>&1 && break
+        sleep 0.1
+done
+
+if [ -x "$emu" ]; then
+        "$emu" -i 60 >/dev/null 2>&1 &
+fi
+
+failures=0
+
+set_mock() {
+        gdbus call --session --dest org.freedesktop.portal.Desktop \
+                --object-path /org/freedesktop/portal/desktop \
+                --method org.freedesktop.DBus.Properties.Set \
+                org.blight.MockPortal "$1" "<$2>" >/dev/null
+}
+
+run_blight() {
+        : >"$log"
+        timeout "$run_seconds" "$blight" -H 127.0.0.1 >"$out" 2>&1 || true
+}
+
+check() {
+        if eval "$2"; then
+                echo "PASS: $1"
+        else
+                echo "FAIL: $1"
+                sed 's/^/  portal: /' "$log"
+                sed 's/^/  blight: /' "$out"
+                failures=$((failures + 1))
+        fi
+}
+
+# 1. First run: no token yet, the picker is shown and a token is stored
+rm -f "$token_file"
+run_blight
+check "first run shows the picker and stores a token" \
+        'grep -q dialog-shown "$log" && [ -s "$token_file" ]'
+
+# 2. Token accepted: no picker, and the single-use token is replaced
+previous=$(cat "$token_file" 2>/dev/null || true)
+run_blight
+check "stored token is accepted without a picker" \
+        'grep -q "token-accepted $previous" "$log" && ! grep -q dialog-shown "$log"'
+check "accepted token is replaced by the new one" \
+        '[ -s "$token_file" ] && [ "$(cat "$token_file")" != "$previous" ]'
+
+if [ -n "${BLIGHT_TEST_NODE:-}" ]; then
+        check "first LED frame after a token restore" 'grep "First LED frame" "$out"'
+else
+        echo "SKIP: time to first LED frame (set BLIGHT_TEST_NODE)"
+fi
+
+# 3. Unknown token: the portal ignores it and shows the picker once, the new
+# token replaces it
+echo "revoked-token" >"$token_file"
+run_blight
+check "unknown token makes the portal show the picker once" \
+        'grep -q "token-unknown revoked-token" "$log" &&
+         [ "$(grep -c dialog-shown "$log")" -eq 1 ]'
+check "unknown token is replaced by the new one" \
+        '[ -s "$token_file" ] && [ "$(cat "$token_file")" != revoked-token ]'
+
+# 4. Backend error: Start keeps failing, blight retries and the token survives
+previous=$(cat "$token_file" 2>/dev/null || true)
+set_mock FailStart true
+run_blight
+set_mock FailStart false
+check "failed start is retried without a picker" \
+        '[ "$(grep -c start-failed "$log")" -ge 2 ] && ! grep -q dialog-shown "$log"'
+check "failed start keeps the stored token" \
+        '[ -n "$previous" ] && [ "$(cat "$token_file")" = "$previous" ]'
+
+# 5. Picker cancelled: the stored token is kept for the next unattended start
+echo "stale-token" >"$token_file"
+set_mock CancelDialog true
+run_blight
+check "cancelling the picker keeps the stored token" \
+        'grep -q dialog-cancelled "$log" && [ "$(cat "$token_file")" = stale-token ]'
+
+[ "$failures" -eq 0 ]